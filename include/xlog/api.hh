@@ -7,6 +7,7 @@
   #define XLOG_LOG_API_HH
 
   #include "xlog/detail/config.hh"
+  #include "xlog/detail/json.hh"
   #include "xlog/detail/logger.hh"
   #include "xlog/detail/util.hh"
 
@@ -17,10 +18,33 @@ template<size_t ID>
 class Logger;
 
 namespace util {
-inline std::unordered_map<size_t, std::shared_ptr<xlog::ILogger>> allLoggers;
-inline std::unordered_map<size_t, std::string>                    names;
+inline std::unordered_map<size_t, std::string> names;
 } // namespace util
 
+/// @brief 按名字获取运行期 logger, 不存在时创建; 可在运行期用任意字符串创建成千上万个 logger
+/// @param name logger 名字, 与同名(同 hash)的编译期 Logger<hashed(name)> 是同一个实例
+/// @return 整数句柄, 通过 HXLOG / HXLOGFMT 记录日志, 开销与 Logger<ID> 相同;
+/// 注册表已满时返回 invalid_logger_handle, 对它记录日志什么也不做
+/// @note 新建的 logger 与默认 logger 共用创建时它的输出; 之后默认 logger 再用 InstantiateFileLogger 换了输出,
+/// 已创建的 logger 仍写到原来的输出(只有控制台时即一直写控制台). 应先初始化默认 logger 再调用 getLogger;
+/// 需要单独的文件时对 loggerOf(handle) 调用 init
+inline logger_handle getLogger(std::string_view name) {
+  size_t const key = hashed(name);
+  if (logger_handle h = registry().find(key); h != invalid_logger_handle) [[likely]] { return h; }
+  ILogger* main = Logger<>::getInstance();
+  return registry().add(key, [&] {
+    return BasicLogger::create(name, main->sink(), main->isAsynced());
+  });
+}
+
+/// @brief 只查找不创建
+/// @return 不存在时返回 invalid_logger_handle
+inline logger_handle findLogger(std::string_view name) { return registry().find(hashed(name)); }
+
+/// @brief 句柄对应的 logger, 无锁无等待
+/// @return 无效句柄返回 nullptr
+inline ILogger* loggerOf(logger_handle handle) { return registry().get(handle); }
+
 /// @brief  实例化日志记录器
 /// @tparam NameId  可以根据ID实例化不同logger
 /// @param level    日志输出的最小等级
@@ -29,12 +53,30 @@ inline std::unordered_map<size_t, std::string>                    names;
 /// @param console  是否同时开启console日志
 /// @param fileMaxSize  单个日志文件最大字节数 默认 10KB
 /// @param maxFileCount 最大日志文件个数, 不能超过1000, >1 时开启滚动日志
-/// @param alwaysFlush  写入一条刷新一次
+/// @param alwaysFlush  同步模式每条、异步模式每批刷新一次
+/// @param bufferSize   文件写缓冲区字节数, 默认 64KB, 0 表示不缓冲
 /// @note NameId 是一个字符串(默认 "Main")的 hash， "Main"_hash / hashed("Main")
 template<size_t NameId = hashed(logger_default_name)>
 inline void InstantiateFileLogger(Level level, std::string const& filename = {}, bool async = true, bool console = true,
-                                  size_t fileMaxSize = 10_KB, size_t maxFileCount = 1, bool alwaysFlush = false) {
-  Logger<NameId>::Instance()->init(level, async, console, filename, fileMaxSize, maxFileCount, alwaysFlush);
+                                  size_t fileMaxSize = 10_KB, size_t maxFileCount = 1, bool alwaysFlush = false,
+                                  size_t bufferSize = XLOG_FILE_BUFFER_SIZE) {
+  Logger<NameId>::Instance()->init(level, async, console, filename, fileMaxSize, maxFileCount, alwaysFlush,
+                                   bufferSize);
+}
+
+/// @brief 以内存映射追加模式实例化日志记录器
+/// @tparam NameId  logger的ID
+/// @param level    日志输出的最小等级
+/// @param filename 日志文件名, 实际文件为 stem.N.ext, N 单调递增
+/// @param segmentSize  单个日志段的字节数, 预先 fallocate
+/// @param maxFileCount 最多保留的日志段个数, 0 表示不限制
+/// @param console  是否同时开启console日志
+/// @note 调用线程直接写入映射内存, 不经过写线程也不加锁; 数据进入 page cache 后即使进程崩溃也不会丢失.
+/// Windows 上退化为普通的同步文件日志.
+template<size_t NameId = hashed(logger_default_name)>
+inline void InstantiateMmapLogger(Level level, std::string const& filename, size_t segmentSize = 64_MB,
+                                  size_t maxFileCount = 0, bool console = false) {
+  Logger<NameId>::Instance()->initMapped(level, console, filename, segmentSize, maxFileCount);
 }
 
 /// @brief 修改日志记录级别
@@ -61,6 +103,122 @@ inline void toggleConsoleLogging(bool enable) {
   Logger<ID>::Instance()->setConsole(enable);
 }
 
+/// @brief 设置日志文件的滚动方式
+/// @tparam ID  logger id
+/// @param mode RENAME: 滚动时逐个重命名旧文件(默认);
+/// SEQUENCE: 文件按 stem.N.ext 单调编号, 下一个段由后台线程提前打开, 每次滚动只删除最旧的一个
+template<size_t ID = hashed(logger_default_name)>
+inline void setLogRollMode(RollMode mode) {
+  Logger<ID>::Instance()->setRollMode(mode);
+}
+
+/// @brief 按时间周期切分日志文件, 与 fileMaxSize 的大小上限同时生效
+/// @tparam ID  logger id
+/// @param interval HOURLY: stem.YYYYMMDD-HH.ext; DAILY: stem.YYYYMMDD.ext; NONE: 关闭
+template<size_t ID = hashed(logger_default_name)>
+inline void setLogRollInterval(RollInterval interval) {
+  Logger<ID>::Instance()->setRollInterval(interval);
+}
+
+/// @brief 在低优先级后台线程中压缩滚动出的日志段, 压缩完成后原子替换原文件, 保留个数把压缩文件也计算在内
+/// @tparam ID  logger id
+/// @param method GZIP(定义 XLOG_ENABLE_COMPRESSION, 链接 zlib) 或 ZSTD(定义 XLOG_ENABLE_ZSTD, 链接 libzstd)
+/// @return 实际使用的压缩格式, 库不可用时退回 GZIP 或 NONE
+template<size_t ID = hashed(logger_default_name)>
+inline Compression setLogCompression(Compression method) {
+  return Logger<ID>::Instance()->setCompression(method);
+}
+
+/// @brief 选择日志时间戳的来源
+/// @tparam ID  logger id
+/// @param mode SYSTEM: system_clock::now() (默认); COARSE: CLOCK_REALTIME_COARSE, 毫秒级精度;
+/// TSC: 调用线程只读取 CPU 计数器, 写线程按周期性校准的结果换算为墙上时间
+template<size_t ID = hashed(logger_default_name)>
+inline void setLogClock(ClockMode mode) {
+  Logger<ID>::Instance()->setClockMode(mode);
+}
+
+/// @brief 设置行格式, 格式串在编译期解析, 未知的占位符是编译错误
+/// @tparam Pattern 例如 "%H:%M:%S.%f %L [%n] %v", 占位符见 XLOG_DEFAULT_PATTERN 的说明
+/// @tparam ID  logger id
+/// @param zone 时间按本地时区(默认)还是 UTC 输出; RFC 3339 可写作 "%DT%T.%f%z"
+/// @note 格式属于 Sink, 共用同一个输出的运行期 logger 一起生效
+template<refvalue::meta_string Pattern, size_t ID = hashed(logger_default_name)>
+inline void setLogPattern(TimeZone zone = TimeZone::LOCAL) {
+  Logger<ID>::Instance()->setLayout(zone == TimeZone::UTC ? &detail::layout_of<Pattern, TimeZone::UTC>
+                                                          : &detail::layout_of<Pattern>);
+}
+
+/// @brief 改为每行输出一个 JSON 对象, 包含时间、等级、logger、线程、调用点、日志内容和 kv 字段;
+/// 同步和异步模式都适用, 再次调用 setLogPattern 可以换回文本格式
+/// @tparam ID  logger id
+/// @param zone 时间按本地时区(默认, 带 +08:00 形式的偏移)还是 UTC(以 Z 结尾)输出
+template<size_t ID = hashed(logger_default_name)>
+inline void setLogJson(TimeZone zone = TimeZone::LOCAL) {
+  Logger<ID>::Instance()->setLayout(zone == TimeZone::UTC ? &detail::json_layout<TimeZone::UTC>
+                                                          : &detail::json_layout<TimeZone::LOCAL>);
+}
+
+/// @brief 日志文件改写紧凑的二进制格式: 调用点、logger 名字和格式串只在每个文件中出现一次,
+/// 记录只保存编号、时间差、线程 ID 和原始参数, 延迟格式化的记录在写线程上也不再格式化;
+/// 用 tools/xlog_decode 还原为文本. 控制台输出不受影响
+/// @tparam ID  logger id
+/// @return 内存映射模式或没有日志文件时返回 false
+/// @note 应在开始记录日志前调用
+template<size_t ID = hashed(logger_default_name)>
+inline bool setLogBinary(bool enable = true) {
+  return Logger<ID>::Instance()->setBinaryFormat(enable);
+}
+
+/// @brief 在每个日志文件旁写稀疏时间索引 "<文件名>.idx", 供 tools/xlog_query 按时间范围快速定位
+/// @tparam ID  logger id
+/// @param interval 每写出多少字节记录一个索引项, 0 为关闭
+/// @return 内存映射模式或没有日志文件时返回 false
+template<size_t ID = hashed(logger_default_name)>
+inline bool setLogIndex(size_t interval = XLOG_INDEX_INTERVAL) {
+  return Logger<ID>::Instance()->setIndexInterval(interval);
+}
+
+/// @brief 异步模式下合并连续重复的日志: 同一调用点、同样内容的记录连续出现时只写第一条,
+/// 随后补一行 "last message repeated N times"
+/// @tparam ID  logger id
+/// @param window 合并的时间窗口, 重复持续更久时每个窗口写出一次; 0 为关闭
+template<size_t ID = hashed(logger_default_name)>
+inline void setLogDedup(std::chrono::milliseconds window = std::chrono::seconds(10)) {
+  Logger<ID>::Instance()->setDedupWindow(window);
+}
+
+/// @brief 安装致命信号(SIGSEGV/SIGBUS/SIGFPE/SIGILL/SIGABRT/SIGTERM)处理函数, 默认不安装.
+/// 收到信号时先把各个 logger 异步队列中的记录写完, 再在日志文件和 stderr 上追加一行崩溃信息和调用栈,
+/// 最后恢复原来的处理方式并重新发出信号
+/// @param budget 处理的时间上限, 磁盘卡住时也能按时退出
+/// @return Windows 上不支持, 返回 false
+/// @note 在主线程上尽早调用, 栈溢出时使用的备用信号栈只为调用线程设置
+inline bool installCrashHandler(std::chrono::milliseconds budget = std::chrono::milliseconds(XLOG_CRASH_BUDGET_MS)) {
+  return detail::install_crash_handler(budget);
+}
+
+/// @brief 限制异步队列的长度, 写线程跟不上时按策略阻塞或丢弃
+/// @tparam ID  logger id
+/// @param capacity  队列最多容纳的记录数, 0 表示不限制(默认)
+/// @param policy    BLOCK / BLOCK_TIMEOUT / DROP_NEWEST / DROP_OLDEST / DROP_BELOW_LEVEL
+/// @param timeout   BLOCK_TIMEOUT 的最长等待时间
+/// @param threshold DROP_BELOW_LEVEL 时, 低于该等级的记录在队列满时被丢弃
+/// @note 丢弃的条数由写线程至多每秒一次以 WARN 日志报告
+template<size_t ID = hashed(logger_default_name)>
+inline void setQueueOverflow(size_t capacity, OverflowPolicy policy = OverflowPolicy::BLOCK,
+                             std::chrono::milliseconds timeout = std::chrono::milliseconds(10),
+                             Level threshold = Level::WARN) {
+  Logger<ID>::Instance()->setOverflowPolicy(capacity, policy, timeout, threshold);
+}
+
+/// @brief 队列溢出的累计计数
+/// @tparam ID  logger id
+template<size_t ID = hashed(logger_default_name)>
+inline overflow_stats queueOverflowStats() {
+  return Logger<ID>::Instance()->overflowStats();
+}
+
 /// @brief 当前logger是否允许控制台打印日志
 /// @tparam ID  logger id
 /// @return \p true if enabled else \p false
@@ -6,26 +6,91 @@
 #ifndef XLOG_API_MACRO_HH
 #define XLOG_API_MACRO_HH
 
+#include "xlog/detail/call_site.hh"
 #include "xlog/detail/config.hh"
+#include "xlog/detail/sampling.hh"
 
-#define now_               std::chrono::system_clock::now()
-#define instance_ptr(name) xlog::Logger<xlog::util::hashed(std::string_view(name))>::Instance(name)
+#define instance_ptr(name) xlog::Logger<xlog::util::hashed(std::string_view(name))>::getInstance(name)
 #define instance_(name)    (*instance_ptr(name))
+/// 运行期 logger: getLogger(name) 返回的句柄, 无效句柄得到 nullptr, HXLOG 跳过整条语句
+#define handle_ptr(handle) xlog::registry().get(handle)
 
 #define XLOG_IMPL(level, name, ...)                                                                                    \
-  if (!(instance_ptr(name)->checkLevel(level))) {                                                                      \
+  if constexpr ((level) < xlog::active_level) {                                                                        \
+  } else if (!(instance_ptr(name)->checkLevel(level))) {                                                               \
+  } else if (XLOG_DECLARE_SITE(level, xlog::util::hashed(std::string_view(name))); false) {                            \
   } else                                                                                                               \
-    instance_(name) += xlog::record_t(now_, level, GET_STRING(__FILE__, __LINE__)).ref()
+    instance_(name) += xlog::record_t(instance_ptr(name)->now(), &xlog_site_).ref()
 
 #ifndef XLOG
   #define XLOG(level, ...) XLOG_IMPL(xlog::Level::level, __VA_ARGS__)
 #endif
 
+#define HXLOG_IMPL(level, handle)                                                                                      \
+  if constexpr ((level) < xlog::active_level) {                                                                        \
+  } else if (xlog::ILogger* const xlog_logger_ = handle_ptr(handle); xlog_logger_ == nullptr) {                        \
+  } else if (!(xlog_logger_->checkLevel(level))) {                                                                     \
+  } else if (XLOG_DECLARE_SITE(level, 0); false) {                                                                     \
+  } else                                                                                                               \
+    *xlog_logger_ += xlog::record_t(xlog_logger_->now(), &xlog_site_).ref()
+
+/// runtime logger handle
+#ifndef HXLOG
+  #define HXLOG(level, handle) HXLOG_IMPL(xlog::Level::level, handle)
+#endif
+
+/// 采样: 等级检查之后先询问调用点的采样状态(静态、无锁), 被跳过时既不构造记录也不求值 << 右侧的参数;
+/// 输出的记录带有字段 suppressed, 即上一条输出之后被跳过的次数
+#define XLOG_SAMPLED_IMPL(level, name, sampler, ...)                                                                   \
+  if constexpr ((level) < xlog::active_level) {                                                                        \
+  } else if (!(instance_ptr(name)->checkLevel(level))) {                                                               \
+  } else if (static xlog::detail::sampler xlog_sampler_; false) {                                                      \
+  } else if (uint64_t xlog_suppressed_ = 0; !xlog_sampler_.admit(__VA_ARGS__, xlog_suppressed_)) {                     \
+  } else if (XLOG_DECLARE_SITE(level, xlog::util::hashed(std::string_view(name))); false) {                            \
+  } else                                                                                                               \
+    instance_(name) += xlog::record_t(instance_ptr(name)->now(), &xlog_site_).suppressed(xlog_suppressed_)
+
+/// 第 1, n+1, 2n+1 ... 次输出
+#ifndef XLOG_EVERY_N
+  #define XLOG_EVERY_N(level, n) XLOG_SAMPLED_IMPL(xlog::Level::level, logger_default_name, every_n_sampler, n)
+#endif
+/// 只输出前 n 次
+#ifndef XLOG_FIRST_N
+  #define XLOG_FIRST_N(level, n) XLOG_SAMPLED_IMPL(xlog::Level::level, logger_default_name, first_n_sampler, n)
+#endif
+/// 每个时间间隔(std::chrono::duration)最多输出一次
+#ifndef XLOG_EVERY_T
+  #define XLOG_EVERY_T(level, interval)                                                                                \
+    XLOG_SAMPLED_IMPL(xlog::Level::level, logger_default_name, every_t_sampler, interval)
+#endif
+/// 令牌桶限速, 平均每秒 perSecond 条, 允许一秒的突发
+#ifndef XLOG_RATE_LIMITED
+  #define XLOG_RATE_LIMITED(level, perSecond)                                                                          \
+    XLOG_SAMPLED_IMPL(xlog::Level::level, logger_default_name, rate_limiter, perSecond)
+#endif
+
+/// named logger
+#ifndef MXLOG_EVERY_N
+  #define MXLOG_EVERY_N(level, name, n) XLOG_SAMPLED_IMPL(xlog::Level::level, name, every_n_sampler, n)
+#endif
+#ifndef MXLOG_FIRST_N
+  #define MXLOG_FIRST_N(level, name, n) XLOG_SAMPLED_IMPL(xlog::Level::level, name, first_n_sampler, n)
+#endif
+#ifndef MXLOG_EVERY_T
+  #define MXLOG_EVERY_T(level, name, interval) XLOG_SAMPLED_IMPL(xlog::Level::level, name, every_t_sampler, interval)
+#endif
+#ifndef MXLOG_RATE_LIMITED
+  #define MXLOG_RATE_LIMITED(level, name, perSecond)                                                                   \
+    XLOG_SAMPLED_IMPL(xlog::Level::level, name, rate_limiter, perSecond)
+#endif
+
 #define XLOGV_IMPL(level, name, fmt, ...)                                                                              \
-  if (!(instance_ptr(name)->checkLevel(level))) {                                                                      \
+  if constexpr ((level) < xlog::active_level) {                                                                        \
+  } else if (!(instance_ptr(name)->checkLevel(level))) {                                                               \
+  } else if (XLOG_DECLARE_SITE(level, xlog::util::hashed(std::string_view(name))); false) {                            \
   } else                                                                                                               \
     do {                                                                                                               \
-      instance_(name) += xlog::record_t(now_, level, GET_STRING(__FILE__, __LINE__)).sprintf(fmt, __VA_ARGS__);        \
+      instance_(name) += xlog::record_t(instance_ptr(name)->now(), &xlog_site_).sprintf(fmt, __VA_ARGS__);             \
       if constexpr (level == xlog::Level::FATAL) {                                                                     \
         xlog::flushLogs<xlog::util::hashed(name)>();                                                                   \
         std::exit(EXIT_FAILURE);                                                                                       \
@@ -42,21 +107,49 @@
 
 #if __has_include(<fmt/format.h> ) or __has_include(<format>)
   #define XLOGFMT_IMPL0(level, name, prefix, ...)                                                                      \
-    if (!(instance_ptr(name)->checkLevel(level))) {                                                                    \
+    if constexpr ((level) < xlog::active_level) {                                                                      \
+    } else if (!(instance_ptr(name)->checkLevel(level))) {                                                             \
+    } else if (XLOG_DECLARE_SITE(level, xlog::util::hashed(std::string_view(name))); false) {                          \
+    } else                                                                                                             \
+      do {                                                                                                             \
+        instance_(name) += xlog::record_t(instance_ptr(name)->now(), &xlog_site_).format(prefix::format(__VA_ARGS__)); \
+        if constexpr (level == xlog::Level::FATAL) {                                                                   \
+          xlog::flushLogs<xlog::util::hashed(name)>();                                                                 \
+          std::exit(EXIT_FAILURE);                                                                                     \
+        }                                                                                                              \
+      } while (false)
+
+  /// 延迟格式化: 调用线程只序列化参数, 由 Sink 的写线程负责格式化
+  #define XLOGDFMT_IMPL(level, name, ...)                                                                              \
+    if constexpr ((level) < xlog::active_level) {                                                                      \
+    } else if (!(instance_ptr(name)->checkLevel(level))) {                                                             \
+    } else if (XLOG_DECLARE_SITE(level, xlog::util::hashed(std::string_view(name))); false) {                          \
     } else                                                                                                             \
       do {                                                                                                             \
-        instance_(name) +=                                                                                             \
-            xlog::record_t(now_, level, GET_STRING(__FILE__, __LINE__)).format(prefix::format(__VA_ARGS__));           \
+        instance_(name) += xlog::record_t(instance_ptr(name)->now(), &xlog_site_).defer(__VA_ARGS__);                  \
         if constexpr (level == xlog::Level::FATAL) {                                                                   \
           xlog::flushLogs<xlog::util::hashed(name)>();                                                                 \
           std::exit(EXIT_FAILURE);                                                                                     \
         }                                                                                                              \
       } while (false)
 
-  #if __has_include(<fmt/format.h> )
-    #define XLOGFMT_IMPL(level, name, ...) XLOGFMT_IMPL0(level, name, fmt, __VA_ARGS__)
+  #define HXLOGFMT_IMPL(level, handle, method, ...)                                                                    \
+    if constexpr ((level) < xlog::active_level) {                                                                      \
+    } else if (xlog::ILogger* const xlog_logger_ = handle_ptr(handle); xlog_logger_ == nullptr) {                      \
+    } else if (!(xlog_logger_->checkLevel(level))) {                                                                   \
+    } else if (XLOG_DECLARE_SITE(level, 0); false) {                                                                   \
+    } else                                                                                                             \
+      *xlog_logger_ += xlog::record_t(xlog_logger_->now(), &xlog_site_).method(__VA_ARGS__)
+
+  #if defined(XLOG_DEFER_FORMAT)
+    #define XLOGFMT_IMPL(level, name, ...)    XLOGDFMT_IMPL(level, name, __VA_ARGS__)
+    #define HXLOGFMT(level, handle, ...)      HXLOGFMT_IMPL(xlog::Level::level, handle, defer, __VA_ARGS__)
+  #elif __has_include(<fmt/format.h> )
+    #define XLOGFMT_IMPL(level, name, ...)    XLOGFMT_IMPL0(level, name, fmt, __VA_ARGS__)
+    #define HXLOGFMT(level, handle, ...)      HXLOGFMT_IMPL(xlog::Level::level, handle, format, fmt::format(__VA_ARGS__))
   #else
-    #define XLOGFMT_IMPL(level, name, ...) XLOGFMT_IMPL0(level, name, std, __VA_ARGS__)
+    #define XLOGFMT_IMPL(level, name, ...)    XLOGFMT_IMPL0(level, name, std, __VA_ARGS__)
+    #define HXLOGFMT(level, handle, ...)      HXLOGFMT_IMPL(xlog::Level::level, handle, format, std::format(__VA_ARGS__))
   #endif
 
   #ifndef XLOGFMT
@@ -67,6 +160,15 @@
   #ifndef MXLOGFMT
     #define MXLOGFMT(level, name, ...) XLOGFMT_IMPL(xlog::Level::level, name, __VA_ARGS__)
   #endif
+
+  #ifndef XLOGDFMT
+    #define XLOGDFMT(level, ...) XLOGDFMT_IMPL(xlog::Level::level, logger_default_name, __VA_ARGS__)
+  #endif
+
+  /// named logger
+  #ifndef MXLOGDFMT
+    #define MXLOGDFMT(level, name, ...) XLOGDFMT_IMPL(xlog::Level::level, name, __VA_ARGS__)
+  #endif
 #endif
 
 #define XLOG_TRACE XLOG(TRACE, logger_default_name)
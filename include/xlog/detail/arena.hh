@@ -0,0 +1,240 @@
+//
+// xlog / arena.hh
+// Created by brian on 2024-08-04.
+//
+
+#ifndef XLOG_ARENA_HH
+#define XLOG_ARENA_HH
+
+#include "xlog/detail/config.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+
+namespace xlog::detail {
+/// @brief 线程私有 arena 中的一块内存, 按引用计数回收.
+/// 所属线程持有一个引用, 从块中分配出的每段内存各持有一个引用
+struct arena_block {
+  explicit arena_block(size_t cap)
+      : capacity(cap) {}
+
+  char* data() { return reinterpret_cast<char*>(this + 1); }
+
+  std::atomic<uint32_t> refs{1};
+  size_t const          capacity;
+  size_t                used = 0;
+};
+
+inline arena_block* new_arena_block(size_t capacity) {
+  return ::new (::operator new(sizeof(arena_block) + capacity)) arena_block(capacity);
+}
+
+/// @brief 释放一个引用, 最后一个引用释放时归还内存; 可以在任意线程调用
+inline void release_arena_block(arena_block* block) {
+  if (block->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    block->~arena_block();
+    ::operator delete(block);
+  }
+}
+
+/// @brief 每个线程一个的单调分配器.
+/// 记录内容超出内联缓冲区时从这里取内存, 写线程用完记录后释放引用;
+/// 一个块上只剩所属线程的引用时, 它就可以从头重新使用, 稳定状态下不再调用 operator new
+class thread_arena {
+public:
+  static constexpr size_t block_size = XLOG_ARENA_BLOCK_SIZE;
+  static constexpr size_t max_blocks = 8;
+
+  thread_arena() = default;
+
+  thread_arena(const thread_arena&)            = delete;
+  thread_arena& operator=(const thread_arena&) = delete;
+
+  /// 仍在队列中的记录会在写线程用完后释放剩下的引用
+  ~thread_arena() {
+    for (size_t i = 0; i < count_; ++i) release_arena_block(blocks_[i]);
+  }
+
+  static thread_arena& local() {
+    static thread_local thread_arena arena;
+    return arena;
+  }
+
+  /// @brief 分配至少 n 字节, 返回的内存持有 owner 的一个引用
+  /// @param n     请求的字节数, 实际可用的字节数写回 n
+  /// @param owner 用完后交给 release_arena_block
+  char* allocate(size_t& n, arena_block*& owner) {
+    n = (n + 15) & ~size_t(15);
+    // 过大的内容单独分配, 不占用循环使用的块
+    if (n > block_size / 4) return dedicated(n, owner);
+
+    if (count_ == 0 or blocks_[current_]->used + n > block_size) {
+      if (not advance()) return dedicated(n, owner);
+    }
+    arena_block* block = blocks_[current_];
+    char*        p     = block->data() + block->used;
+    block->used += n;
+    block->refs.fetch_add(1, std::memory_order_relaxed);
+    owner = block;
+    return p;
+  }
+
+private:
+  /// 换到一个没有外部引用的块, 都在使用中时新建一个
+  bool advance() {
+    for (size_t i = 1; i <= count_; ++i) {
+      size_t const idx = (current_ + i) % count_;
+      // acquire: 与写线程 release_arena_block 的 acq_rel 配对, 之后才能覆盖其中的数据
+      if (blocks_[idx]->refs.load(std::memory_order_acquire) == 1) {
+        blocks_[idx]->used = 0;
+        current_           = idx;
+        return true;
+      }
+    }
+    if (count_ == max_blocks) return false;
+    blocks_[count_] = new_arena_block(block_size);
+    current_        = count_++;
+    return true;
+  }
+
+  static char* dedicated(size_t n, arena_block*& owner) {
+    owner       = new_arena_block(n);
+    owner->used = n;
+    return owner->data();
+  }
+
+  arena_block* blocks_[max_blocks]{};
+  size_t       count_   = 0;
+  size_t       current_ = 0;
+};
+
+/// @brief 日志内容的缓冲区: 短内容放在对象内部, 超出后转移到当前线程的 arena.
+/// 只能移动, 移动时内联的内容按字节拷贝, arena 中的内容只转移指针
+/// @tparam InlineSize 对象内部的字节数
+template<size_t InlineSize>
+class basic_record_buffer {
+public:
+  static constexpr size_t inline_size = InlineSize;
+
+  basic_record_buffer() noexcept
+      : data_(inline_) {}
+
+  basic_record_buffer(basic_record_buffer&& other) noexcept { steal(other); }
+
+  basic_record_buffer& operator=(basic_record_buffer&& other) noexcept {
+    if (this != &other) {
+      reset();
+      steal(other);
+    }
+    return *this;
+  }
+
+  ~basic_record_buffer() { reset(); }
+
+  const char* data() const { return data_; }
+  size_t      size() const { return size_; }
+  bool        empty() const { return size_ == 0; }
+  std::string_view view() const { return {data_, size_}; }
+
+  basic_record_buffer& append(const char* str, size_t n) {
+    std::memcpy(prepare(n), str, n);
+    size_ += n;
+    return *this;
+  }
+
+  basic_record_buffer& append(std::string_view str) { return append(str.data(), str.size()); }
+
+  void push_back(char c) {
+    *prepare(1) = c;
+    ++size_;
+  }
+
+  /// @brief 保证还能再写入 n 字节, 返回写入位置; 写完后用 commit 确认实际长度
+  char* prepare(size_t n) {
+    if (size_ + n > capacity_) [[unlikely]] { grow(size_ + n); }
+    return data_ + size_;
+  }
+
+  void commit(size_t n) { size_ += n; }
+
+  void assign(std::string_view str) {
+    size_ = 0;
+    append(str);
+  }
+
+  /// 清空内容并归还 arena 中的内存
+  void reset() {
+    if (block_) {
+      release_arena_block(block_);
+      block_    = nullptr;
+      data_     = inline_;
+      capacity_ = inline_size;
+    }
+    size_ = 0;
+  }
+
+private:
+  void grow(size_t need) {
+    size_t       cap   = std::max(capacity_ * 2, need);
+    arena_block* owner = nullptr;
+    char*        p     = thread_arena::local().allocate(cap, owner);
+    std::memcpy(p, data_, size_);
+    if (block_) release_arena_block(block_);
+    data_     = p;
+    capacity_ = cap;
+    block_    = owner;
+  }
+
+  void steal(basic_record_buffer& other) {
+    size_ = other.size_;
+    if (other.block_) {
+      data_     = other.data_;
+      capacity_ = other.capacity_;
+      block_    = other.block_;
+
+      other.data_     = other.inline_;
+      other.capacity_ = inline_size;
+      other.block_    = nullptr;
+    } else {
+      data_ = inline_;
+      std::memcpy(inline_, other.inline_, size_);
+    }
+    other.size_ = 0;
+  }
+
+  char*        data_;
+  size_t       size_     = 0;
+  size_t       capacity_ = inline_size;
+  arena_block* block_    = nullptr;
+  char         inline_[inline_size];
+};
+
+/// 日志内容
+using record_buffer = basic_record_buffer<XLOG_RECORD_INLINE_SIZE>;
+/// 结构化字段, 多数记录没有字段, 内联部分较小
+using field_buffer = basic_record_buffer<XLOG_FIELD_INLINE_SIZE>;
+
+/// @brief 把 logger 名字放入进程级的字符串池, 返回池中的字符串, 在进程退出前一直有效.
+/// logger 保存它的指针, 改名时整体原子替换
+inline const std::string* intern_string(std::string_view name) {
+  static std::mutex mtx;
+  // 有意不释放: 静态对象析构时 Sink 可能仍在写出引用这些名字的记录
+  static auto* pool = new std::unordered_set<std::string>;
+  std::lock_guard guard(mtx);
+  return &*pool->emplace(name).first;
+}
+
+/// @brief 同 intern_string, 返回视图.
+/// 记录只保存名字的视图, 不随 logger 改名或销毁而失效
+inline std::string_view intern_name(std::string_view name) { return *intern_string(name); }
+} // namespace xlog::detail
+
+#endif // XLOG_ARENA_HH
@@ -0,0 +1,148 @@
+//
+// xlog / binlog.hh
+// Created by brian on 2024-08-10.
+//
+
+#ifndef XLOG_BINLOG_HH
+#define XLOG_BINLOG_HH
+
+#include "xlog/detail/record.hh"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace xlog::detail {
+/// @brief 二进制日志的文件头, 每个文件(以及每次重新打开后追加的部分)都以它开头,
+/// 解码器遇到文件头就清空字典, 因此各个段可以单独解码, 也可以直接拼接后从 stdin 读入
+constexpr inline std::string_view binlog_magic{"XLOGBIN\x01", 8};
+
+/// @brief 文件头之后的帧, 第一个字节是帧类型.
+/// 字典帧在某个调用点、logger 名字或延迟格式串第一次出现时写出, 之后的记录只引用编号:
+///   site:   id, level(1 字节), line, file, function
+///   logger: id, name
+///   format: id, 格式串
+///   record: site id, logger id, 与上一条记录的时间差(纳秒, zigzag), 线程 ID,
+///           格式串 id(0 表示 payload 是已经格式化好的文本), payload, 字段
+/// 整数都是 LEB128 varint, 字符串为 varint 长度 + 字节; payload 和字段保存记录中的原始字节
+enum class binlog_frame : uint8_t {
+  site   = 1,
+  logger = 2,
+  format = 3,
+  record = 4,
+};
+
+inline void append_varint(std::string& out, uint64_t value) {
+  char  buf[10];
+  char* p = buf;
+  while (value >= 0x80) {
+    *p++ = static_cast<char>(value | 0x80);
+    value >>= 7;
+  }
+  *p++ = static_cast<char>(value);
+  out.append(buf, p);
+}
+
+inline void append_bytes(std::string& out, std::string_view bytes) {
+  append_varint(out, bytes.size());
+  out.append(bytes);
+}
+
+/// @brief 读取一个 varint
+/// @return 数据不完整或超过 64 位时返回 false, p 不变
+inline bool read_varint(const char*& p, const char* end, uint64_t& value) {
+  uint64_t result = 0;
+  for (const char* q = p; q < end and q - p < 10; ++q) {
+    auto const byte = static_cast<uint8_t>(*q);
+    result |= static_cast<uint64_t>(byte & 0x7F) << (7 * (q - p));
+    if (byte < 0x80) {
+      value = result;
+      p     = q + 1;
+      return true;
+    }
+  }
+  return false;
+}
+
+inline bool read_bytes(const char*& p, const char* end, std::string_view& bytes) {
+  const char* q = p;
+  uint64_t    len;
+  if (not read_varint(q, end, len) or static_cast<uint64_t>(end - q) < len) return false;
+  bytes = {q, static_cast<size_t>(len)};
+  p     = q + len;
+  return true;
+}
+
+constexpr uint64_t zigzag(int64_t v) { return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63); }
+
+constexpr int64_t unzigzag(uint64_t v) { return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1); }
+
+/// @brief 把记录编码为二进制帧.
+/// 调用点按描述符地址、logger 名字和格式串按字符串地址(都是静态存储或 intern_name 的结果)分配编号,
+/// 延迟格式化的记录直接写出参数的原始字节, 写线程上不再格式化;
+/// 有状态, 由 Sink 在持有文件锁时使用, 每打开一个文件调用一次 begin
+class binary_encoder {
+public:
+  /// @brief 开始一个新文件: 写出文件头, 清空字典和时间基准
+  void begin(std::string& out) {
+    sites_.clear();
+    loggers_.clear();
+    formats_.clear();
+    lastNanos_ = 0;
+    out.append(binlog_magic);
+  }
+
+  void encode(std::string& out, const record_t& record) {
+    uint64_t const site   = siteId(out, record.getSite());
+    uint64_t const logger = stringId(out, loggers_, binlog_frame::logger, record.getLoggerName());
+    uint64_t const format =
+        record.isDeferred() ? stringId(out, formats_, binlog_frame::format, record.getDeferredFormat()) : 0;
+    int64_t const nanos =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(record.getTimePoint().time_since_epoch()).count();
+
+    out.push_back(static_cast<char>(binlog_frame::record));
+    append_varint(out, site);
+    append_varint(out, logger);
+    append_varint(out, zigzag(nanos - lastNanos_));
+    append_varint(out, record.getThreadId());
+    append_varint(out, format);
+    append_bytes(out, record.getRawContent());
+    append_bytes(out, record.getFields());
+    lastNanos_ = nanos;
+  }
+
+private:
+  uint64_t siteId(std::string& out, const call_site& site) {
+    auto [it, added] = sites_.try_emplace(&site, sites_.size() + 1);
+    if (added) {
+      out.push_back(static_cast<char>(binlog_frame::site));
+      append_varint(out, it->second);
+      out.push_back(static_cast<char>(site.level));
+      append_varint(out, site.line);
+      append_bytes(out, site.file);
+      append_bytes(out, site.function);
+    }
+    return it->second;
+  }
+
+  static uint64_t stringId(std::string& out, std::unordered_map<const char*, uint64_t>& dict, binlog_frame frame,
+                           std::string_view str) {
+    auto [it, added] = dict.try_emplace(str.data(), dict.size() + 1);
+    if (added) {
+      out.push_back(static_cast<char>(frame));
+      append_varint(out, it->second);
+      append_bytes(out, str);
+    }
+    return it->second;
+  }
+
+  std::unordered_map<const call_site*, uint64_t> sites_;
+  std::unordered_map<const char*, uint64_t>      loggers_;
+  std::unordered_map<const char*, uint64_t>      formats_;
+  int64_t                                        lastNanos_ = 0;
+};
+} // namespace xlog::detail
+
+#endif // XLOG_BINLOG_HH
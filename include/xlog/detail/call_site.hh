@@ -0,0 +1,62 @@
+//
+// xlog / call_site.hh
+// Created by brian on 2024-08-05.
+//
+
+#ifndef XLOG_CALL_SITE_HH
+#define XLOG_CALL_SITE_HH
+
+#include "xlog/detail/level.hh"
+#include "xlog/vendor/meta_string.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+
+namespace xlog::detail {
+/// @brief 一条日志语句的静态描述.
+/// 每个调用点在编译期生成一个 static constexpr 实例, 记录只保存指向它的指针
+struct call_site {
+  /// 源文件名(不含目录)
+  std::string_view file;
+  /// "file:line", 编译期拼好
+  std::string_view location;
+  /// "[file:line] "
+  std::string_view prefix;
+  std::string_view function;
+  uint32_t         line     = 0;
+  Level            level    = Level::TRACE;
+  /// 编译期 logger 的 hashed(name); 运行期 logger(HXLOG) 为 0
+  size_t           loggerId = 0;
+};
+
+/// @brief 由 __FILE__ 和 __LINE__ 在编译期生成的字符串, 每个 (文件, 行) 只有一份静态存储
+template<refvalue::meta_string Path, refvalue::meta_string Line>
+struct site_strings {
+  static constexpr size_t pos      = Path.rfind(std::filesystem::path::preferred_separator);
+  static constexpr auto   name     = Path.template substr<pos + 1>();
+  static constexpr auto   location = name + ":" + Line;
+  static constexpr auto   prefix   = "[" + location + "] ";
+};
+
+/// 不来自日志宏的记录(如 Sink 自己的提示)使用的描述符
+template<Level L>
+constexpr inline call_site internal_site{"xlog", "xlog", {}, "xlog", 0, L, 0};
+} // namespace xlog::detail
+
+#define XLOG_STRINGIFY_(x) #x
+#define XLOG_STRINGIFY(x)  XLOG_STRINGIFY_(x)
+
+#define XLOG_SITE_STRINGS                                                                                              \
+  xlog::detail::site_strings<refvalue::meta_string{__FILE__}, refvalue::meta_string{XLOG_STRINGIFY(__LINE__)}>
+
+/// @brief 声明当前调用点的描述符 xlog_site_.
+/// 放在 if 的初始化语句中, 作用域覆盖其后的 else 分支, 宏依旧可以作为一条语句使用
+#define XLOG_DECLARE_SITE(level, id)                                                                                   \
+  static constexpr xlog::detail::call_site xlog_site_ {                                                                \
+    XLOG_SITE_STRINGS::name, XLOG_SITE_STRINGS::location, XLOG_SITE_STRINGS::prefix,                                   \
+        std::string_view{__func__, sizeof(__func__) - 1}, __LINE__, level, id                                          \
+  }
+
+#endif // XLOG_CALL_SITE_HH
@@ -0,0 +1,217 @@
+//
+// xlog / clock.hh
+// Created by brian on 2024-08-07.
+//
+
+#ifndef XLOG_CLOCK_HH
+#define XLOG_CLOCK_HH
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+
+#if defined(__x86_64__) or defined(__i386__)
+  #include <x86intrin.h>
+#elif defined(_M_X64) or defined(_M_IX86)
+  #include <intrin.h>
+#endif
+
+namespace xlog {
+/// @brief 日志时间戳的来源, 按 logger 选择
+enum class ClockMode : uint8_t {
+  /// system_clock::now(), Linux 上为一次 vDSO clock_gettime
+  SYSTEM,
+  /// CLOCK_REALTIME_COARSE, 精度为一个时钟节拍(通常 1~4ms), 其他平台同 SYSTEM
+  COARSE,
+  /// 调用线程只读取 CPU 时间戳计数器, 由写线程按校准结果换算为墙上时间;
+  /// 要求 CPU 支持 invariant TSC
+  TSC,
+};
+
+/// @brief 记录中保存的时间戳: TSC 模式下是原始计数, 其他模式下是 system_clock 的 tick 数
+struct log_stamp {
+  int64_t value = 0;
+  bool    tsc   = false;
+};
+
+namespace detail {
+/// 读取 CPU 时间戳计数器, 没有可用指令的平台退回 steady_clock
+inline uint64_t read_tsc() {
+#if defined(__x86_64__) or defined(__i386__) or defined(_M_X64) or defined(_M_IX86)
+  return __rdtsc();
+#elif defined(__aarch64__)
+  uint64_t ticks;
+  asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+  return ticks;
+#else
+  return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+/// @brief TSC 计数到 system_clock 的换算.
+/// 首次使用时用 2ms 粗略校准; 之后换算时发现距上次同步超过同步间隔, 就由换算的线程(异步模式下即写线程)
+/// 重新采样一对 (tsc, 墙上时间): 频率按从第一次采样起的整个跨度计算, 基准点换成最新的采样,
+/// 同步间隔从 10ms 开始逐次翻倍到 1 秒, 启动后很快就能得到准确的频率;
+/// 系统时间被调整或频率漂移时误差不会累积. 参数用 seqlock 发布, 换算不加锁
+class tsc_clock {
+  using wall_clock = std::chrono::system_clock;
+
+public:
+  static tsc_clock& instance() {
+    static tsc_clock clock;
+    return clock;
+  }
+
+  tsc_clock(const tsc_clock&)            = delete;
+  tsc_clock& operator=(const tsc_clock&) = delete;
+
+  /// @brief 一组换算参数: 基准点 (baseTsc, baseWall) 和每 tick 纳秒数
+  struct params {
+    int64_t  baseWall  = 0;
+    uint64_t baseTsc   = 0;
+    double   nsPerTick = 0;
+
+    /// 换算为 Unix 纳秒
+    int64_t toNanos(uint64_t ticks) const {
+      return baseWall + static_cast<int64_t>(static_cast<double>(static_cast<int64_t>(ticks - baseTsc)) * nsPerTick);
+    }
+  };
+
+  /// @brief 读取当前发布的参数, 不触发同步也不加锁
+  params current() const {
+    params   p;
+    uint32_t seq;
+    do {
+      seq         = seq_.load(std::memory_order_acquire);
+      p.baseWall  = baseWall_.load(std::memory_order_relaxed);
+      p.baseTsc   = baseTsc_.load(std::memory_order_relaxed);
+      p.nsPerTick = nsPerTick_.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((seq & 1) or seq != seq_.load(std::memory_order_relaxed));
+    return p;
+  }
+
+  /// @brief 把 TSC 计数换算为 system_clock 的时间点
+  wall_clock::time_point toTimePoint(uint64_t ticks) {
+    params p;
+    for (;;) {
+      p = current();
+      // 同步成功后按新参数重新换算
+      if (static_cast<int64_t>(ticks - p.baseTsc) <= resyncTicks_.load(std::memory_order_relaxed) or not resync())
+          [[likely]] {
+        break;
+      }
+    }
+    return wall_clock::time_point(
+        std::chrono::duration_cast<wall_clock::duration>(std::chrono::nanoseconds(p.toNanos(ticks))));
+  }
+
+  /// 当前的每 tick 纳秒数
+  double nanosPerTick() const { return nsPerTick_.load(std::memory_order_relaxed); }
+
+  /// @brief 已经创建并校准的实例, 没有 logger 使用过 TSC 时返回 nullptr, 不会触发校准
+  static const tsc_clock* existing() { return created_.load(std::memory_order_acquire); }
+
+private:
+  static constexpr int64_t max_resync_interval_ns = 1'000'000'000;
+
+  struct sample {
+    uint64_t tsc;
+    int64_t  wall;
+  };
+
+  tsc_clock() {
+    origin_                 = take();
+    auto const calibrateEnd = origin_.wall + 2'000'000;
+    sample     now          = take();
+    while (now.wall < calibrateEnd) now = take();
+    publish(now, rate(origin_, now));
+    created_.store(this, std::memory_order_release);
+  }
+
+  static int64_t wallNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(wall_clock::now().time_since_epoch()).count();
+  }
+
+  /// 用墙上时间两侧的 TSC 平均值减小采样误差
+  static sample take() {
+    uint64_t const before = read_tsc();
+    int64_t const  wall   = wallNanos();
+    uint64_t const after  = read_tsc();
+    return {before + (after - before) / 2, wall};
+  }
+
+  static double rate(const sample& from, const sample& to) {
+    if (to.tsc == from.tsc) return 1.0;
+    return static_cast<double>(to.wall - from.wall) / static_cast<double>(to.tsc - from.tsc);
+  }
+
+  /// @return 是否发布了新参数
+  bool resync() {
+    // 已有线程在同步时直接使用旧参数
+    std::unique_lock lock(mtx_, std::try_to_lock);
+    if (not lock.owns_lock()) return false;
+    sample const now = take();
+    if (static_cast<int64_t>(now.tsc - baseTsc_.load(std::memory_order_relaxed)) <=
+        resyncTicks_.load(std::memory_order_relaxed)) {
+      return false;
+    }
+    publish(now, rate(origin_, now));
+    return true;
+  }
+
+  /// 只在构造函数或持有 mtx_ 时调用
+  void publish(const sample& base, double nsPerTick) {
+    uint32_t const seq = seq_.load(std::memory_order_relaxed);
+    seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    baseWall_.store(base.wall, std::memory_order_relaxed);
+    baseTsc_.store(base.tsc, std::memory_order_relaxed);
+    nsPerTick_.store(nsPerTick, std::memory_order_relaxed);
+    seq_.store(seq + 2, std::memory_order_release);
+    resyncTicks_.store(static_cast<int64_t>(static_cast<double>(interval_) / nsPerTick), std::memory_order_relaxed);
+    interval_ = std::min(interval_ * 2, max_resync_interval_ns);
+  }
+
+  std::atomic<uint32_t> seq_{0};
+  std::atomic<int64_t>  baseWall_{0};
+  std::atomic<uint64_t> baseTsc_{0};
+  std::atomic<double>   nsPerTick_{1.0};
+  std::atomic<int64_t>  resyncTicks_{INT64_MAX};
+  std::mutex            mtx_;
+  sample                origin_{};
+  int64_t               interval_ = 10'000'000;
+
+  inline static std::atomic<const tsc_clock*> created_{nullptr};
+};
+
+/// @brief 按模式取当前时间戳, 日志宏在调用线程上调用
+inline log_stamp stamp_now(ClockMode mode) {
+  switch (mode) {
+  case ClockMode::TSC:
+    return {static_cast<int64_t>(read_tsc()), true};
+#if defined(__linux__) and defined(CLOCK_REALTIME_COARSE)
+  case ClockMode::COARSE: {
+    timespec ts;
+    ::clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    auto const d = std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+    return {std::chrono::duration_cast<std::chrono::system_clock::duration>(d).count(), false};
+  }
+#endif
+  default:
+    return {std::chrono::system_clock::now().time_since_epoch().count(), false};
+  }
+}
+
+/// @brief 把记录中的时间戳换算为 system_clock 的时间点, 在写线程上调用
+inline std::chrono::system_clock::time_point to_time_point(log_stamp stamp) {
+  if (stamp.tsc) return tsc_clock::instance().toTimePoint(static_cast<uint64_t>(stamp.value));
+  return std::chrono::system_clock::time_point(std::chrono::system_clock::duration(stamp.value));
+}
+} // namespace detail
+} // namespace xlog
+
+#endif // XLOG_CLOCK_HH
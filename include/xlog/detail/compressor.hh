@@ -0,0 +1,236 @@
+//
+// xlog / compressor.hh
+// Created by brian on 2024-07-30.
+//
+
+#ifndef XLOG_COMPRESSOR_HH
+#define XLOG_COMPRESSOR_HH
+
+#include "xlog/detail/config.hh"
+
+#if defined(XLOG_ENABLE_COMPRESSION) and __has_include(<zlib.h>)
+  #define XLOG_HAS_ZLIB 1
+  #include <zlib.h>
+#endif
+#if defined(XLOG_ENABLE_ZSTD) and __has_include(<zstd.h>)
+  #define XLOG_HAS_ZSTD 1
+  #include <zstd.h>
+#endif
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+
+#ifndef _WIN32
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+#ifdef __linux__
+  #include <sys/resource.h>
+  #include <sys/syscall.h>
+#endif
+
+namespace xlog {
+/// @brief 滚动出的日志段的压缩格式
+enum class Compression {
+  NONE,
+  /// stem.N.ext.gz, 需要链接 zlib
+  GZIP,
+  /// stem.N.ext.zst, 需要链接 libzstd, 不可用时退回 GZIP
+  ZSTD,
+};
+
+/// @brief 在低优先级后台线程中压缩已关闭的日志段.
+/// 先写入 *.tmp 并落盘, 再 rename 为最终文件名, 最后删除原文件,
+/// 因此任何时刻目录中都至少有一份完整的数据
+/// @note gzip 需要定义 XLOG_ENABLE_COMPRESSION 并链接 zlib(-lz),
+/// zstd 需要定义 XLOG_ENABLE_ZSTD 并链接 libzstd(-lzstd)
+class segment_compressor {
+public:
+  explicit segment_compressor(Compression method)
+      : method_(resolve(method)) {
+    worker_ = std::thread([this] { run(); });
+  }
+
+  segment_compressor(const segment_compressor&)            = delete;
+  segment_compressor& operator=(const segment_compressor&) = delete;
+
+  /// 未压缩完的段保持原样留在磁盘上, 不拖慢进程退出
+  ~segment_compressor() {
+    {
+      std::lock_guard guard(mtx_);
+      stopped_ = true;
+    }
+    cnd_.notify_all();
+    worker_.join();
+  }
+
+  /// @brief 把已关闭的日志段加入压缩队列
+  void enqueue(std::string path) {
+    if (method_ == Compression::NONE or path.empty()) return;
+    {
+      std::lock_guard guard(mtx_);
+      pending_.push_back(std::move(path));
+    }
+    cnd_.notify_all();
+  }
+
+  Compression method() const { return method_; }
+
+  /// @brief 按编译时可用的库降级: ZSTD -> GZIP -> NONE
+  static Compression resolve([[maybe_unused]] Compression wanted) {
+#ifdef XLOG_HAS_ZSTD
+    if (wanted == Compression::ZSTD) return wanted;
+#endif
+#ifdef XLOG_HAS_ZLIB
+    if (wanted != Compression::NONE) return Compression::GZIP;
+#endif
+    return Compression::NONE;
+  }
+
+  static std::string_view suffix(Compression method) {
+    switch (method) {
+    case Compression::GZIP:
+      return ".gz";
+    case Compression::ZSTD:
+      return ".zst";
+    default:
+      return {};
+    }
+  }
+
+private:
+  void run() {
+    lowerPriority();
+    std::unique_lock lock(mtx_);
+    for (;;) {
+      cnd_.wait(lock, [this] { return stopped_ or not pending_.empty(); });
+      if (stopped_) break;
+      std::string path = std::move(pending_.front());
+      pending_.pop_front();
+      lock.unlock();
+      compressFile(path);
+      lock.lock();
+    }
+  }
+
+  /// 降低线程的 CPU 和 IO 优先级, 避免与写线程争抢
+  static void lowerPriority() {
+#ifdef __linux__
+    auto const tid = static_cast<id_t>(::syscall(SYS_gettid));
+    if (::setpriority(PRIO_PROCESS, tid, 19) != 0) {}
+  #ifdef SYS_ioprio_set
+    // IOPRIO_WHO_PROCESS, IOPRIO_CLASS_IDLE
+    if (::syscall(SYS_ioprio_set, 1, static_cast<int>(tid), 3 << 13) != 0) {}
+  #endif
+#endif
+  }
+
+  void compressFile(const std::string& path) {
+    std::string const target = std::string(path).append(suffix(method_));
+    std::string const tmp    = std::string(target).append(".tmp");
+    bool              ok     = false;
+#ifdef XLOG_HAS_ZSTD
+    if (method_ == Compression::ZSTD) ok = zstdFile(path, tmp);
+#endif
+#ifdef XLOG_HAS_ZLIB
+    if (method_ == Compression::GZIP) ok = gzipFile(path, tmp);
+#endif
+    std::error_code ec;
+    // 压缩期间原文件可能已按保留个数被删除, 此时不能再把它的压缩文件放回去
+    ok = ok and syncFile(tmp) and std::filesystem::exists(path, ec);
+    if (ok) std::filesystem::rename(tmp, target, ec);
+    if (not ok or ec) {
+      std::filesystem::remove(tmp, ec);
+      return;
+    }
+    std::filesystem::remove(path, ec);
+  }
+
+  bool stopping() {
+    std::lock_guard guard(mtx_);
+    return stopped_;
+  }
+
+#ifdef XLOG_HAS_ZLIB
+  bool gzipFile(const std::string& src, const std::string& dst) {
+    std::unique_ptr<FILE, decltype(&std::fclose)> in(std::fopen(src.c_str(), "rb"), &std::fclose);
+    if (not in) return false;
+    gzFile out = ::gzopen(dst.c_str(), "wb6");
+    if (out == nullptr) return false;
+    std::unique_ptr<char[]> buf(new char[chunk_size]);
+    bool                    ok = true;
+    while (size_t n = std::fread(buf.get(), 1, chunk_size, in.get())) {
+      if (stopping() or ::gzwrite(out, buf.get(), static_cast<unsigned>(n)) != static_cast<int>(n)) {
+        ok = false;
+        break;
+      }
+    }
+    ok = ::gzclose(out) == Z_OK and ok and not std::ferror(in.get());
+    return ok;
+  }
+#endif
+
+#ifdef XLOG_HAS_ZSTD
+  bool zstdFile(const std::string& src, const std::string& dst) {
+    std::unique_ptr<FILE, decltype(&std::fclose)> in(std::fopen(src.c_str(), "rb"), &std::fclose);
+    if (not in) return false;
+    std::unique_ptr<FILE, decltype(&std::fclose)> out(std::fopen(dst.c_str(), "wb"), &std::fclose);
+    if (not out) return false;
+    std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> cctx(ZSTD_createCCtx(), &ZSTD_freeCCtx);
+    if (not cctx) return false;
+    ZSTD_CCtx_setParameter(cctx.get(), ZSTD_c_compressionLevel, 3);
+
+    size_t const            outSize = ZSTD_CStreamOutSize();
+    std::unique_ptr<char[]> inBuf(new char[chunk_size]);
+    std::unique_ptr<char[]> outBuf(new char[outSize]);
+    for (;;) {
+      size_t const n    = std::fread(inBuf.get(), 1, chunk_size, in.get());
+      bool const   last = n < chunk_size;
+      if (stopping() or std::ferror(in.get())) return false;
+      ZSTD_inBuffer input{inBuf.get(), n, 0};
+      bool          done = false;
+      while (not done) {
+        ZSTD_outBuffer output{outBuf.get(), outSize, 0};
+        size_t const   rc = ZSTD_compressStream2(cctx.get(), &output, &input, last ? ZSTD_e_end : ZSTD_e_continue);
+        if (ZSTD_isError(rc)) return false;
+        if (std::fwrite(outBuf.get(), 1, output.pos, out.get()) != output.pos) return false;
+        done = last ? rc == 0 : input.pos == input.size;
+      }
+      if (last) break;
+    }
+    return std::fflush(out.get()) == 0;
+  }
+#endif
+
+  static bool syncFile(const std::string& path) {
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    bool const ok = ::fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+#else
+    return true;
+#endif
+  }
+
+  static constexpr size_t chunk_size = 256 << 10;
+
+  Compression const       method_;
+  std::mutex              mtx_;
+  std::condition_variable cnd_;
+  std::deque<std::string> pending_;
+  bool                    stopped_ = false;
+  std::thread             worker_;
+};
+} // namespace xlog
+
+#endif // XLOG_COMPRESSOR_HH
@@ -6,4 +6,83 @@
 #ifndef CONFIG_HH
 #define CONFIG_HH
 #define logger_default_name "Main"
+
+/// 编译期最低日志等级, 取值与 xlog::Level 相同: 1=TRACE 2=DEBUG 3=INFO 4=WARN 5=ERROR 6=FATAL.
+/// 例如 release 构建中 -DXLOG_ACTIVE_LEVEL=3 会让 TRACE/DEBUG 语句完全不产生代码
+#ifndef XLOG_ACTIVE_LEVEL
+  #define XLOG_ACTIVE_LEVEL 1
+#endif
+
+/// 定义 XLOG_ENABLE_SPSC_QUEUE 后, 异步 Sink 为每个生产者线程分配独立的 SPSC 环形队列,
+/// 代替所有线程共用的 moodycamel 队列
+// #define XLOG_ENABLE_SPSC_QUEUE
+
+/// 每个线程环形队列可容纳的记录数(向上取整为 2 的幂)
+#ifndef XLOG_SPSC_RING_SIZE
+  #define XLOG_SPSC_RING_SIZE 8192
+#endif
+
+/// 异步写线程每批最多取出的记录数, 整批格式化后一次写入文件
+#ifndef XLOG_WRITE_BATCH_SIZE
+  #define XLOG_WRITE_BATCH_SIZE 256
+#endif
+
+/// 默认的行格式, 在编译期解析, 占位符见 pattern.hh:
+/// %Y %m %d %H %M %S 日期时间, %D 即 %Y-%m-%d, %T 即 %H:%M:%S, %z UTC 偏移(+08:00), %E unix 秒数,
+/// %e/%f/%F 毫秒/微秒/纳秒, %l 等级, %n logger 名字, %t 线程 ID,
+/// %s 文件名:行号, %! 函数名, %v 日志内容, %k 结构化字段(" key=value"), %^...%$ 控制台上按等级着色的范围, %% 为 '%'
+#ifndef XLOG_DEFAULT_PATTERN
+  #define XLOG_DEFAULT_PATTERN "%^%Y-%m-%d %H:%M:%S.%e %l%$[%n] [%t] [%s] %^%v%$%k"
+#endif
+
+/// setLogIndex 默认每写出多少字节记录一个时间索引项
+#ifndef XLOG_INDEX_INTERVAL
+  #define XLOG_INDEX_INTERVAL (64 * 1024)
+#endif
+
+/// 每条记录对象内部可容纳的内容字节数, 超出部分从线程私有的 arena 分配
+#ifndef XLOG_RECORD_INLINE_SIZE
+  #define XLOG_RECORD_INLINE_SIZE 160
+#endif
+
+/// 每条记录对象内部可容纳的结构化字段(kv)字节数, 超出部分同样从 arena 分配
+#ifndef XLOG_FIELD_INLINE_SIZE
+  #define XLOG_FIELD_INLINE_SIZE 64
+#endif
+
+/// 线程私有 arena 每块的字节数, 每个线程最多循环使用 8 块
+#ifndef XLOG_ARENA_BLOCK_SIZE
+  #define XLOG_ARENA_BLOCK_SIZE (64 << 10)
+#endif
+
+/// 日志文件用户态写缓冲区的默认大小(字节)
+#ifndef XLOG_FILE_BUFFER_SIZE
+  #define XLOG_FILE_BUFFER_SIZE (64 << 10)
+#endif
+
+/// 定义 XLOG_ENABLE_IO_URING 后, Linux 上的日志文件通过 io_uring 异步写入,
+/// 内核不支持时自动退回 write; XLOG_IO_URING_BUFFERS 为轮转使用的缓冲区个数,
+/// XLOG_IO_URING_DATASYNC 为 true 时每次刷新额外提交一个 fdatasync
+// #define XLOG_ENABLE_IO_URING
+#ifndef XLOG_IO_URING_BUFFERS
+  #define XLOG_IO_URING_BUFFERS 4
+#endif
+#ifndef XLOG_IO_URING_DATASYNC
+  #define XLOG_IO_URING_DATASYNC false
+#endif
+
+/// installCrashHandler 的默认时间上限(毫秒): 收到致命信号后最多花这么久写完排队的日志
+#ifndef XLOG_CRASH_BUDGET_MS
+  #define XLOG_CRASH_BUDGET_MS 2000
+#endif
+
+/// 崩溃时能够处理的 Sink 个数上限
+#ifndef XLOG_CRASH_MAX_SINKS
+  #define XLOG_CRASH_MAX_SINKS 64
+#endif
+
+/// 定义 XLOG_ENABLE_COMPRESSION 后可以在后台把滚动出的日志段压缩为 gzip, 需要链接 zlib(-lz);
+/// 另外定义 XLOG_ENABLE_ZSTD 后还可以使用 zstd, 需要链接 libzstd(-lzstd). CMake 中对应同名的 option
+// #define XLOG_ENABLE_COMPRESSION
+// #define XLOG_ENABLE_ZSTD
 #endif //CONFIG_HH
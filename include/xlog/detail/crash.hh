@@ -0,0 +1,318 @@
+//
+// xlog / crash.hh
+// Created by brian on 2024-08-12.
+//
+
+#ifndef XLOG_CRASH_HH
+#define XLOG_CRASH_HH
+
+#include "xlog/detail/clock.hh"
+#include "xlog/detail/config.hh"
+#include "xlog/detail/pattern.hh"
+#include "xlog/detail/time_util.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <iterator>
+#include <mutex>
+#include <string_view>
+#include <thread>
+
+#ifndef _WIN32
+  #include <unistd.h>
+  #if defined(__linux__)
+    #include <sys/syscall.h>
+  #elif defined(__APPLE__)
+    #include <pthread.h>
+  #endif
+  #if __has_include(<execinfo.h>)
+    #include <execinfo.h>
+    #define XLOG_HAS_BACKTRACE 1
+  #endif
+#endif
+
+namespace xlog::detail {
+/// @brief 崩溃时要把排队的日志写完的对象(即 Sink), 完全构造后登记, 析构前注销
+class crash_target {
+public:
+  /// @brief 在信号处理函数中调用: 写出排队的记录并把缓冲的数据交给内核.
+  /// 只能使用异步信号安全的操作, 不分配内存、不等锁, 超过 deadline(crash_clock)就放弃
+  virtual void drainOnCrash(int64_t deadline) noexcept = 0;
+
+  /// 崩溃信息和调用栈追加到的文件描述符, 没有时返回 -1
+  virtual int crashFd() noexcept = 0;
+
+protected:
+  ~crash_target() = default;
+};
+
+/// @brief 带"被持有"标志的互斥量, 保护 Sink 的文件.
+/// 信号处理函数不能对互斥量调用 try_lock(它可能正被崩溃的线程自己持有), 改为抢占这个标志:
+/// 抢到说明没有线程在用文件, 之后拿到锁的线程会一直等到标志被释放
+class crash_mutex {
+public:
+  void lock() {
+    mtx_.lock();
+    while (held_.exchange(true, std::memory_order_acquire)) std::this_thread::yield();
+  }
+
+  void unlock() {
+    held_.store(false, std::memory_order_release);
+    mtx_.unlock();
+  }
+
+  /// 信号处理函数中调用, 不等待; 返回 true 时用完要调用 release
+  bool tryClaim() noexcept { return not held_.exchange(true, std::memory_order_acquire); }
+
+  void release() noexcept { held_.store(false, std::memory_order_release); }
+
+private:
+  std::mutex        mtx_;
+  std::atomic<bool> held_{false};
+};
+
+inline std::atomic<crash_target*> crash_targets[XLOG_CRASH_MAX_SINKS]{};
+
+inline void add_crash_target(crash_target* target) {
+  for (auto& slot : crash_targets) {
+    crash_target* expected = nullptr;
+    if (slot.compare_exchange_strong(expected, target)) return;
+  }
+}
+
+inline void remove_crash_target(crash_target* target) {
+  for (auto& slot : crash_targets) {
+    crash_target* expected = target;
+    if (slot.compare_exchange_strong(expected, nullptr)) return;
+  }
+}
+
+#ifndef _WIN32
+/// 单调时钟(纳秒), clock_gettime 是异步信号安全的
+inline int64_t crash_clock() {
+  timespec ts{};
+  ::clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1'000'000'000LL + ts.tv_nsec;
+}
+
+inline void crash_sleep(int64_t nanos) {
+  timespec ts{nanos / 1'000'000'000, static_cast<long>(nanos % 1'000'000'000)};
+  ::nanosleep(&ts, nullptr);
+}
+
+inline void crash_write(int fd, const char* p, size_t len) {
+  while (len > 0) {
+    ssize_t const n = ::write(fd, p, len);
+    if (n < 0 and errno == EINTR) continue;
+    if (n <= 0) return;
+    p += n;
+    len -= static_cast<size_t>(n);
+  }
+}
+
+inline uint32_t crash_tid() {
+  #if defined(__linux__)
+  return static_cast<uint32_t>(::syscall(__NR_gettid));
+  #elif defined(__APPLE__)
+  uint64_t tid = 0;
+  pthread_threadid_np(nullptr, &tid);
+  return static_cast<uint32_t>(tid);
+  #else
+  return 0;
+  #endif
+}
+
+/// 安装时记下的本地 UTC 偏移: 信号处理函数中不能调用 localtime
+inline std::atomic<int32_t> crash_utc_offset{0};
+
+/// 安装时(或之后第一次切换到 TSC 时)记下的 TSC 换算参数: tsc_clock 换算时可能重新同步, 要加锁.
+/// 离记下时越久误差越大, 只用于紧急格式的毫秒时间
+inline std::atomic<int64_t>  crash_tsc_wall{0};
+inline std::atomic<uint64_t> crash_tsc_base{0};
+inline std::atomic<double>   crash_tsc_rate{0};
+
+/// @brief 把记录的原始时间戳换算为 Unix 纳秒, 不调用 tsc_clock
+inline int64_t crash_stamp_nanos(log_stamp stamp) {
+  if (not stamp.tsc) {
+    auto const since = std::chrono::system_clock::duration(stamp.value);
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(since).count();
+  }
+  tsc_clock::params const snapshot{crash_tsc_wall.load(std::memory_order_relaxed),
+                                   crash_tsc_base.load(std::memory_order_relaxed),
+                                   crash_tsc_rate.load(std::memory_order_relaxed)};
+  return snapshot.toNanos(static_cast<uint64_t>(stamp.value));
+}
+
+/// @brief 不分配内存地按默认行格式写一条记录到 buf, 超出 cap 的部分截断, 总以换行结尾
+/// @return 写入的字节数
+inline size_t format_crash_line(char* buf, size_t cap, int64_t nanos, Level level, std::string_view logger,
+                                uint32_t tid, std::string_view prefix, std::string_view message) {
+  char*       p   = buf;
+  char* const end = buf + cap - 1;
+  auto const  put = [&](std::string_view str) {
+    size_t const n = (std::min)(str.size(), static_cast<size_t>(end - p));
+    std::memcpy(p, str.data(), n);
+    p += n;
+  };
+  int64_t const    sec   = time_util::floor_div(nanos, 1'000'000'000);
+  auto const       civil = time_util::civil_from_unix(sec + crash_utc_offset.load(std::memory_order_relaxed));
+  char             stamp[24];
+  char*            s = time_util::write_digits<4>(stamp, static_cast<uint32_t>(civil.year));
+  *s++               = '-';
+  s                  = time_util::write_digits<2>(s, civil.month);
+  *s++               = '-';
+  s                  = time_util::write_digits<2>(s, civil.day);
+  *s++               = ' ';
+  s                  = time_util::write_digits<2>(s, civil.hour);
+  *s++               = ':';
+  s                  = time_util::write_digits<2>(s, civil.minute);
+  *s++               = ':';
+  s                  = time_util::write_digits<2>(s, civil.second);
+  *s++               = '.';
+  s                  = time_util::write_digits<3>(s, static_cast<uint32_t>((nanos - sec * 1'000'000'000) / 1'000'000));
+  *s++               = ' ';
+  put({stamp, static_cast<size_t>(s - stamp)});
+  put(helper::LevelStr(level));
+  put("[");
+  put(logger);
+  put("] [");
+  char digits[16];
+  put({digits, static_cast<size_t>(std::to_chars(digits, digits + sizeof(digits), tid).ptr - digits)});
+  put("] ");
+  put(prefix);
+  put(message);
+  *p++ = '\n';
+  return p - buf;
+}
+
+constexpr inline int crash_signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT, SIGTERM};
+
+inline std::string_view crash_signal_name(int sig) {
+  switch (sig) {
+  case SIGSEGV: return "SIGSEGV";
+  case SIGBUS: return "SIGBUS";
+  case SIGFPE: return "SIGFPE";
+  case SIGILL: return "SIGILL";
+  case SIGABRT: return "SIGABRT";
+  case SIGTERM: return "SIGTERM";
+  default: return "signal";
+  }
+}
+
+/// 处理一个信号的总时间上限(纳秒)
+inline std::atomic<int64_t> crash_budget{0};
+/// 安装前的处理方式, 处理完后恢复并重新发出信号
+inline struct sigaction crash_previous[std::size(crash_signals)];
+
+/// @brief 致命信号的处理函数: 让各个 Sink 写完排队的记录, 追加一行崩溃信息和调用栈, 再按原来的方式重新发出信号.
+/// 其他线程同时崩溃时只等待第一个线程处理完
+inline void on_crash_signal(int sig, siginfo_t*, void*) {
+  static std::atomic<bool> entered{false};
+  int const     savedErrno = errno;
+  int64_t const deadline   = crash_clock() + crash_budget.load(std::memory_order_relaxed);
+  if (not entered.exchange(true)) {
+    void* frames[64];
+  #ifdef XLOG_HAS_BACKTRACE
+    int const depth = ::backtrace(frames, static_cast<int>(std::size(frames)));
+  #else
+    int const depth = 0;
+  #endif
+    char message[64];
+    char* m = message;
+    auto const append = [&](std::string_view str) { m = std::copy(str.begin(), str.end(), m); };
+    append("caught ");
+    append(crash_signal_name(sig));
+    append(" (");
+    m = std::to_chars(m, message + sizeof(message), sig).ptr;
+    append("), stack trace:");
+    timespec now{};
+    ::clock_gettime(CLOCK_REALTIME, &now);
+    char         line[256];
+    size_t const len = format_crash_line(line, sizeof(line), now.tv_sec * 1'000'000'000LL + now.tv_nsec,
+                                         Level::FATAL, "xlog", crash_tid(), {},
+                                         {message, static_cast<size_t>(m - message)});
+
+    for (auto& slot : crash_targets) {
+      crash_target* target = slot.load(std::memory_order_acquire);
+      if (target == nullptr) continue;
+      target->drainOnCrash(deadline);
+      if (int const fd = target->crashFd(); fd >= 0) {
+        crash_write(fd, line, len);
+  #ifdef XLOG_HAS_BACKTRACE
+        ::backtrace_symbols_fd(frames, depth, fd);
+  #endif
+      }
+    }
+    crash_write(STDERR_FILENO, line, len);
+  #ifdef XLOG_HAS_BACKTRACE
+    ::backtrace_symbols_fd(frames, depth, STDERR_FILENO);
+  #endif
+  } else {
+    // 另一个线程正在处理, 它结束进程前不要抢先
+    while (crash_clock() < deadline) crash_sleep(10'000'000);
+  }
+  for (size_t i = 0; i < std::size(crash_signals); ++i) {
+    if (crash_signals[i] == sig) ::sigaction(sig, &crash_previous[i], nullptr);
+  }
+  errno = savedErrno;
+  ::raise(sig);
+}
+#endif
+
+/// @brief 记下当前的 TSC 换算参数供信号处理函数使用; 还没有 logger 使用 TSC 时什么也不做(不触发校准),
+/// logger 切换到 TSC 时会再调用一次
+inline void snapshot_crash_tsc() {
+#ifndef _WIN32
+  tsc_clock const* const clock = tsc_clock::existing();
+  if (clock == nullptr) return;
+  auto const tsc = clock->current();
+  crash_tsc_wall.store(tsc.baseWall, std::memory_order_relaxed);
+  crash_tsc_base.store(tsc.baseTsc, std::memory_order_relaxed);
+  crash_tsc_rate.store(tsc.nsPerTick, std::memory_order_relaxed);
+#endif
+}
+
+/// @brief 安装致命信号(SIGSEGV/SIGBUS/SIGFPE/SIGILL/SIGABRT/SIGTERM)的处理函数, 见 on_crash_signal.
+/// 备用信号栈只为调用线程设置, 其他线程栈溢出时无法处理
+/// @param budget 处理一个信号最多花费的时间, 磁盘卡住时也能按时退出
+/// @return Windows 上不支持, 返回 false
+inline bool install_crash_handler(std::chrono::milliseconds budget) {
+#ifdef _WIN32
+  return false;
+#else
+  crash_budget.store(std::chrono::duration_cast<std::chrono::nanoseconds>(budget).count(),
+                     std::memory_order_relaxed);
+  crash_utc_offset.store(time_util::local_utc_offset(std::time(nullptr)), std::memory_order_relaxed);
+  snapshot_crash_tsc();
+  #ifdef XLOG_HAS_BACKTRACE
+  // 第一次调用 backtrace 时会加载 libgcc 并分配内存, 不能留到信号处理函数中
+  void* warmUp[1];
+  ::backtrace(warmUp, 1);
+  #endif
+  static std::atomic<bool> installed{false};
+  if (installed.exchange(true)) return true;
+
+  alignas(16) static char altStack[64 * 1024];
+  stack_t                 stack{};
+  stack.ss_sp    = altStack;
+  stack.ss_size  = sizeof(altStack);
+  ::sigaltstack(&stack, nullptr);
+
+  struct sigaction action {};
+  action.sa_sigaction = on_crash_signal;
+  action.sa_flags     = SA_SIGINFO | SA_ONSTACK;
+  sigemptyset(&action.sa_mask);
+  for (size_t i = 0; i < std::size(crash_signals); ++i) ::sigaction(crash_signals[i], &action, &crash_previous[i]);
+  return true;
+#endif
+}
+} // namespace xlog::detail
+
+#endif // XLOG_CRASH_HH
@@ -0,0 +1,296 @@
+//
+// xlog / deferred.hh
+// Created by brian on 2024-07-20.
+//
+
+#ifndef XLOG_DEFERRED_HH
+#define XLOG_DEFERRED_HH
+
+#if __has_include(<fmt/format.h> )
+  #ifndef FMT_HEADER_ONLY
+    #define FMT_HEADER_ONLY
+  #endif
+  #include <fmt/format.h>
+  #define XLOG_HAS_FMT_LIB 1
+#elif __has_include(<format>)
+  #include <format>
+  #define XLOG_HAS_STD_FORMAT 1
+#endif
+
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace xlog::detail {
+/// 延迟格式化时单条日志最多支持的参数个数
+constexpr inline size_t max_deferred_args = 16;
+
+/// @brief 序列化参数的类型标签, 每个参数占 1 字节标签 + 定长/变长载荷
+enum class arg_tag : uint8_t {
+  none = 0,
+  i64,
+  u64,
+  f64,
+  boolean,
+  character,
+  string,  // uint32 长度 + 字节
+  pointer,
+};
+
+/// @brief 后台线程解码出来的参数, 字符串直接引用 record 内的字节
+struct arg_value {
+  arg_tag tag = arg_tag::none;
+  union {
+    int64_t     i;
+    uint64_t    u;
+    double      f;
+    bool        b;
+    char        c;
+    const void* p;
+  };
+  std::string_view s;
+
+  arg_value()
+      : u(0) {}
+};
+
+template<typename T>
+constexpr inline bool is_string_like_v =
+    std::is_convertible_v<const T&, std::string_view> and not std::is_same_v<T, std::nullptr_t>;
+
+template<typename Buffer, typename T>
+inline void encode_pod(Buffer& out, arg_tag tag, const T& value) {
+  char buf[1 + sizeof(T)];
+  buf[0] = static_cast<char>(tag);
+  std::memcpy(buf + 1, &value, sizeof(T));
+  out.append(buf, sizeof(buf));
+}
+
+template<typename Buffer>
+inline void encode_string(Buffer& out, std::string_view str) {
+  auto const len = static_cast<uint32_t>(str.size());
+  char       buf[1 + sizeof(len)];
+  buf[0] = static_cast<char>(arg_tag::string);
+  std::memcpy(buf + 1, &len, sizeof(len));
+  out.append(buf, sizeof(buf)).append(str.data(), len);
+}
+
+/// @brief 把一个参数按原始字节追加到 out, 不做任何文本格式化
+/// @tparam Buffer std::string 或 record_buffer 等提供 append(const char*, size_t) 的缓冲区
+template<typename Buffer, typename T>
+inline void encode_arg(Buffer& out, const T& value) {
+  using U = std::remove_cvref_t<T>;
+  if constexpr (std::is_same_v<U, bool>) {
+    encode_pod(out, arg_tag::boolean, value);
+  } else if constexpr (std::is_same_v<U, char>) {
+    encode_pod(out, arg_tag::character, value);
+  } else if constexpr (std::is_integral_v<U> and std::is_signed_v<U>) {
+    encode_pod(out, arg_tag::i64, static_cast<int64_t>(value));
+  } else if constexpr (std::is_integral_v<U>) {
+    encode_pod(out, arg_tag::u64, static_cast<uint64_t>(value));
+  } else if constexpr (std::is_floating_point_v<U>) {
+    encode_pod(out, arg_tag::f64, static_cast<double>(value));
+  } else if constexpr (is_string_like_v<U>) {
+    if constexpr (std::is_pointer_v<U>) {
+      // 空的 C 字符串不能构造 string_view
+      if (value == nullptr) return encode_string(out, "(null)");
+    }
+    encode_string(out, std::string_view(value));
+  } else if constexpr (std::is_pointer_v<U> or std::is_same_v<U, std::nullptr_t>) {
+    encode_pod(out, arg_tag::pointer, static_cast<const void*>(value));
+  } else {
+    // 其他类型无法安全地跨线程保存, 只能在调用线程上先转成字符串
+#if defined(XLOG_HAS_FMT_LIB)
+    encode_string(out, fmt::format("{}", value));
+#elif defined(XLOG_HAS_STD_FORMAT)
+    encode_string(out, std::format("{}", value));
+#else
+    std::ostringstream ss;
+    ss << value;
+    encode_string(out, std::move(ss).str());
+#endif
+  }
+}
+
+template<typename Buffer, typename... Args>
+inline void encode_args(Buffer& out, const Args&... args) {
+  static_assert(sizeof...(Args) <= max_deferred_args, "too many arguments for deferred logging");
+  (encode_arg(out, args), ...);
+}
+
+template<typename T>
+inline const char* decode_pod(const char* p, T& value) {
+  std::memcpy(&value, p, sizeof(T));
+  return p + sizeof(T);
+}
+
+/// @brief 解码 p 处的一个参数
+/// @return 下一个参数的位置, 标签无效时返回 nullptr
+inline const char* decode_arg(const char* p, arg_value& arg) {
+  arg.tag = static_cast<arg_tag>(*p++);
+  switch (arg.tag) {
+  case arg_tag::i64: return decode_pod(p, arg.i);
+  case arg_tag::u64: return decode_pod(p, arg.u);
+  case arg_tag::f64: return decode_pod(p, arg.f);
+  case arg_tag::boolean: return decode_pod(p, arg.b);
+  case arg_tag::character: return decode_pod(p, arg.c);
+  case arg_tag::pointer: return decode_pod(p, arg.p);
+  case arg_tag::string: {
+    uint32_t len = 0;
+    p            = decode_pod(p, len);
+    arg.s        = {p, len};
+    return p + len;
+  }
+  default: return nullptr;
+  }
+}
+
+/// @brief 把 encode_args 产生的字节还原为参数数组
+/// @return 解析出的参数个数
+inline size_t decode_args(std::string_view bytes, arg_value (&args)[max_deferred_args]) {
+  const char* p    = bytes.data();
+  const char* end  = p + bytes.size();
+  size_t      argc = 0;
+  while (p < end and argc < max_deferred_args) {
+    p = decode_arg(p, args[argc++]);
+    if (p == nullptr) return argc - 1;
+  }
+  return argc;
+}
+
+/// @brief 结构化字段: 键按字符串编码, 紧跟着按 encode_arg 编码的值
+template<typename Buffer, typename T>
+inline void encode_field(Buffer& out, std::string_view key, const T& value) {
+  encode_string(out, key);
+  encode_arg(out, value);
+}
+
+/// @brief 依次对 encode_field 产生的每个字段调用 fn(key, value)
+template<typename Fn>
+inline void for_each_field(std::string_view bytes, Fn&& fn) {
+  const char* p   = bytes.data();
+  const char* end = p + bytes.size();
+  arg_value   key, value;
+  while (p < end) {
+    p = decode_arg(p, key);
+    if (p == nullptr or key.tag != arg_tag::string) return;
+    p = decode_arg(p, value);
+    if (p == nullptr) return;
+    fn(key.s, value);
+  }
+}
+
+/// @brief 把解码后的参数按文本追加到 out, 不经过格式化库
+inline void append_arg(std::string& out, const arg_value& arg) {
+  char buf[32];
+  switch (arg.tag) {
+  case arg_tag::i64: out.append(buf, std::to_chars(buf, buf + sizeof(buf), arg.i).ptr); break;
+  case arg_tag::u64: out.append(buf, std::to_chars(buf, buf + sizeof(buf), arg.u).ptr); break;
+  case arg_tag::f64: out.append(buf, std::to_chars(buf, buf + sizeof(buf), arg.f).ptr); break;
+  case arg_tag::boolean: out.append(arg.b ? "true" : "false"); break;
+  case arg_tag::character: out.push_back(arg.c); break;
+  case arg_tag::string: out.append(arg.s); break;
+  case arg_tag::pointer:
+    out.append("0x");
+    out.append(buf, std::to_chars(buf, buf + sizeof(buf), reinterpret_cast<uintptr_t>(arg.p), 16).ptr);
+    break;
+  default: break;
+  }
+}
+
+/// @brief 在后台线程上用解码后的参数完成真正的格式化
+inline void render_deferred(std::string& out, std::string_view fmt, std::string_view bytes) {
+  arg_value args[max_deferred_args];
+  decode_args(bytes, args);
+  auto& [a0, a1, a2, a3, a4, a5, a6, a7, a8, a9, a10, a11, a12, a13, a14, a15] = args;
+#if defined(XLOG_HAS_FMT_LIB)
+  try {
+    fmt::vformat_to(std::back_inserter(out), fmt,
+                    fmt::make_format_args(a0, a1, a2, a3, a4, a5, a6, a7, a8, a9, a10, a11,
+                                          a12, a13, a14, a15));
+  } catch (const fmt::format_error& e) { out.append("[format error: ").append(e.what()).append("]"); }
+#elif defined(XLOG_HAS_STD_FORMAT)
+  try {
+    std::vformat_to(std::back_inserter(out), fmt,
+                    std::make_format_args(a0, a1, a2, a3, a4, a5, a6, a7, a8, a9, a10, a11,
+                                          a12, a13, a14, a15));
+  } catch (const std::format_error& e) { out.append("[format error: ").append(e.what()).append("]"); }
+#else
+  out.append(fmt);
+#endif
+}
+
+#if defined(XLOG_HAS_FMT_LIB)
+template<typename... Args>
+using format_string_t = fmt::format_string<Args...>;
+
+template<typename... Args>
+inline std::string_view format_string_view(format_string_t<Args...> fmt) {
+  fmt::string_view const sv = fmt;
+  return {sv.data(), sv.size()};
+}
+#elif defined(XLOG_HAS_STD_FORMAT)
+template<typename... Args>
+using format_string_t = std::format_string<Args...>;
+
+template<typename... Args>
+inline std::string_view format_string_view(format_string_t<Args...> fmt) {
+  return fmt.get();
+}
+#endif
+} // namespace xlog::detail
+
+#if defined(XLOG_HAS_FMT_LIB) or defined(XLOG_HAS_STD_FORMAT)
+  #if defined(XLOG_HAS_FMT_LIB)
+    #define XLOG_FMT_NS fmt
+  #else
+    #define XLOG_FMT_NS std
+  #endif
+/// @brief arg_value 的格式化器: 记住格式说明, 按真实类型转交给对应的 formatter.
+/// 不支持嵌套的替换字段(如 "{:>{}}" 的动态宽度), 遇到时报格式错误
+template<>
+struct XLOG_FMT_NS::formatter<xlog::detail::arg_value> {
+  std::string_view spec_;
+
+  constexpr auto parse(XLOG_FMT_NS::format_parse_context& ctx) {
+    auto it = ctx.begin();
+    while (it != ctx.end() and *it != '}') {
+      if (*it == '{') throw XLOG_FMT_NS::format_error("nested replacement fields are not supported when deferred");
+      ++it;
+    }
+    spec_ = std::string_view(ctx.begin(), static_cast<size_t>(it - ctx.begin()));
+    return it;
+  }
+
+  template<typename Context>
+  auto format(const xlog::detail::arg_value& arg, Context& ctx) const {
+    using xlog::detail::arg_tag;
+    switch (arg.tag) {
+    case arg_tag::i64: return delegate(arg.i, ctx);
+    case arg_tag::u64: return delegate(arg.u, ctx);
+    case arg_tag::f64: return delegate(arg.f, ctx);
+    case arg_tag::boolean: return delegate(arg.b, ctx);
+    case arg_tag::character: return delegate(arg.c, ctx);
+    case arg_tag::pointer: return delegate(arg.p, ctx);
+    case arg_tag::string: return delegate(arg.s, ctx);
+    default: return ctx.out();
+    }
+  }
+
+private:
+  template<typename T, typename Context>
+  auto delegate(const T& value, Context& ctx) const {
+    XLOG_FMT_NS::formatter<T>          inner;
+    XLOG_FMT_NS::format_parse_context pctx(spec_);
+    inner.parse(pctx);
+    return inner.format(value, ctx);
+  }
+};
+  #undef XLOG_FMT_NS
+#endif
+
+#endif // XLOG_DEFERRED_HH
@@ -0,0 +1,269 @@
+//
+// xlog / file_writer.hh
+// Created by brian on 2024-07-22.
+//
+
+#ifndef XLOG_FILE_WRITER_HH
+#define XLOG_FILE_WRITER_HH
+
+#include "xlog/detail/config.hh"
+
+#ifdef XLOG_ENABLE_IO_URING
+  #include "xlog/detail/uring_writer.hh"
+#endif
+
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+#ifdef _WIN32
+  #include <fcntl.h>
+  #include <io.h>
+  #include <sys/stat.h>
+#else
+  #include <fcntl.h>
+  #include <sys/stat.h>
+  #include <sys/uio.h>
+  #include <unistd.h>
+#endif
+
+namespace xlog {
+/// @brief 基于文件描述符的追加写入器, 自带固定大小的用户态缓冲区
+/// @note 非线程安全, 由 Sink 负责加锁.
+/// 定义 XLOG_ENABLE_IO_URING 且内核支持时改用 uring_writer 异步提交, 否则使用 write/writev
+class file_writer {
+public:
+  explicit file_writer(size_t bufferSize = 64 << 10)
+      : capacity_(bufferSize) {}
+
+  file_writer(const file_writer&)            = delete;
+  file_writer& operator=(const file_writer&) = delete;
+
+  ~file_writer() { close(); }
+
+  /// @brief 以追加方式打开(或创建)文件
+  /// @return 失败时返回 false 并设置 ec, 不会终止进程
+  bool open(const std::string& filename, std::error_code& ec) {
+    close();
+#ifdef _WIN32
+    int fd = ::_open(filename.c_str(), openFlags(), _S_IREAD | _S_IWRITE);
+#else
+    int fd = ::open(filename.c_str(), openFlags(), 0644);
+#endif
+    if (fd < 0) {
+      ec = std::error_code(errno, std::generic_category());
+      return false;
+    }
+    adopt(fd);
+    return true;
+  }
+
+  /// @brief 打开日志文件应使用的标志, 供在其他线程上提前打开文件时使用
+  int openFlags() {
+#ifdef _WIN32
+    return _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY;
+#else
+  #ifdef XLOG_HAS_IO_URING
+    if (not uringTried_) {
+      uringTried_ = true;
+      uring_      = std::make_unique<uring_writer>(capacity_, XLOG_IO_URING_BUFFERS, XLOG_IO_URING_DATASYNC);
+      if (not uring_->init()) uring_.reset(); // 内核不支持时退回 write
+    }
+    // io_uring 按显式偏移写入, 不能使用 O_APPEND
+    int const append = uring_ ? 0 : O_APPEND;
+  #else
+    int const append = O_APPEND;
+  #endif
+    return O_WRONLY | O_CREAT | append | O_CLOEXEC;
+#endif
+  }
+
+  /// @brief 接管一个以 openFlags() 打开的文件描述符, 之前打开的文件会先被关闭
+  void adopt(int fd) {
+    close();
+    fd_ = fd;
+#ifdef _WIN32
+    struct _stat64 st{};
+    fileSize_ = ::_fstat64(fd_, &st) == 0 ? static_cast<size_t>(st.st_size) : 0;
+#else
+    struct stat st{};
+    fileSize_ = ::fstat(fd_, &st) == 0 ? static_cast<size_t>(st.st_size) : 0;
+#endif
+    failed_ = false;
+#ifdef XLOG_HAS_IO_URING
+    if (uring_) return uring_->attach(fd_, fileSize_);
+#endif
+    if (not buffer_ and capacity_ > 0) buffer_.reset(new char[capacity_]);
+    used_ = 0;
+  }
+
+  /// @brief 写出全部缓冲数据后交出文件描述符而不关闭, 由调用方在别处关闭
+  int release() {
+    if (fd_ < 0) return -1;
+#ifdef XLOG_HAS_IO_URING
+    if (uring_) uring_->drain();
+#endif
+    flush();
+    return std::exchange(fd_, -1);
+  }
+
+  bool is_open() const { return fd_ >= 0; }
+
+  /// @brief 追加数据; 缓冲区放不下时与已缓冲的数据合并为一次 writev 写出
+  void append(std::string_view data) {
+    if (fd_ < 0 or data.empty()) return;
+    fileSize_ += data.size();
+#ifdef XLOG_HAS_IO_URING
+    if (uring_) return uring_->append(data);
+#endif
+    if (used_ + data.size() <= capacity_) {
+      std::memcpy(buffer_.get() + used_, data.data(), data.size());
+      used_ += data.size();
+      return;
+    }
+    writeAll(buffer_.get(), used_, data.data(), data.size());
+    used_ = 0;
+  }
+
+  /// @brief 把缓冲区中的数据交给内核
+  bool flush() {
+#ifdef XLOG_HAS_IO_URING
+    if (uring_ and fd_ >= 0) {
+      uring_->flush();
+      return not uring_->failed();
+    }
+#endif
+    if (fd_ < 0 or used_ == 0) return not failed_;
+    writeAll(buffer_.get(), used_, nullptr, 0);
+    used_ = 0;
+    return not failed_;
+  }
+
+  /// @brief flush 并把数据落盘
+  bool sync() {
+#ifdef XLOG_HAS_IO_URING
+    if (uring_ and fd_ >= 0) uring_->drain();
+#endif
+    if (not flush()) return false;
+#ifdef _WIN32
+    return ::_commit(fd_) == 0;
+#else
+    return ::fdatasync(fd_) == 0;
+#endif
+  }
+
+  void close() {
+    if (fd_ < 0) return;
+#ifdef XLOG_HAS_IO_URING
+    if (uring_) uring_->drain();
+#endif
+    flush();
+#ifdef _WIN32
+    ::_close(fd_);
+#else
+    ::close(fd_);
+#endif
+    fd_ = -1;
+  }
+
+  /// 文件大小, 包含尚未写出的缓冲数据
+  size_t size() const { return fileSize_; }
+
+  /// 是否发生过写入错误(写入错误时数据会被丢弃)
+  bool failed() const {
+#ifdef XLOG_HAS_IO_URING
+    if (uring_ and uring_->failed()) return true;
+#endif
+    return failed_;
+  }
+  std::error_code error() const {
+#ifdef XLOG_HAS_IO_URING
+    if (uring_ and uring_->failed()) return uring_->error();
+#endif
+    return error_;
+  }
+
+  /// 是否正在使用 io_uring 写入
+  bool usingIoUring() const {
+#ifdef XLOG_HAS_IO_URING
+    return uring_ != nullptr;
+#else
+    return false;
+#endif
+  }
+
+  int fd() const { return fd_; }
+
+  /// @brief 可以直接 write 追加数据的文件描述符(崩溃时使用).
+  /// io_uring 按显式偏移写入, 文件没有以 O_APPEND 打开, 直接 write 会覆盖文件开头, 这时返回 -1
+  int appendFd() const {
+#ifdef XLOG_HAS_IO_URING
+    if (uring_) return -1;
+#endif
+    return fd_;
+  }
+
+private:
+  void writeAll(const char* a, size_t alen, const char* b, size_t blen) {
+#ifdef _WIN32
+    if (alen > 0 and not writeRaw(a, alen)) return;
+    if (blen > 0) writeRaw(b, blen);
+#else
+    while (alen + blen > 0) {
+      iovec   iov[2] = {{const_cast<char*>(a), alen}, {const_cast<char*>(b), blen}};
+      ssize_t n      = alen > 0 ? ::writev(fd_, iov, 2) : ::write(fd_, b, blen);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        setError(errno);
+        return;
+      }
+      auto written = static_cast<size_t>(n);
+      if (written >= alen) {
+        written -= alen;
+        a = nullptr, alen = 0;
+        b += written, blen -= written;
+      } else {
+        a += written, alen -= written;
+      }
+    }
+#endif
+  }
+
+#ifdef _WIN32
+  bool writeRaw(const char* p, size_t len) {
+    while (len > 0) {
+      int n = ::_write(fd_, p, static_cast<unsigned>(len));
+      if (n < 0) {
+        setError(errno);
+        return false;
+      }
+      p += n, len -= static_cast<size_t>(n);
+    }
+    return true;
+  }
+#endif
+
+  void setError(int err) {
+    failed_ = true;
+    error_  = std::error_code(err, std::generic_category());
+  }
+
+  int                     fd_       = -1;
+  size_t                  capacity_ = 0;
+  size_t                  used_     = 0;
+  size_t                  fileSize_ = 0;
+  bool                    failed_   = false;
+  std::error_code         error_;
+  std::unique_ptr<char[]> buffer_;
+#ifdef XLOG_HAS_IO_URING
+  bool                          uringTried_ = false;
+  std::unique_ptr<uring_writer> uring_;
+#endif
+};
+} // namespace xlog
+
+#endif // XLOG_FILE_WRITER_HH
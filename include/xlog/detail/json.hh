@@ -0,0 +1,200 @@
+//
+// xlog / json.hh
+// Created by brian on 2024-08-09.
+//
+
+#ifndef XLOG_JSON_HH
+#define XLOG_JSON_HH
+
+#include "xlog/detail/pattern.hh"
+#include "xlog/detail/time_util.hh"
+
+#include <array>
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#if defined(__SSE2__) or defined(_M_X64) or (defined(_M_IX86_FP) and _M_IX86_FP >= 2)
+  #include <emmintrin.h>
+  #define XLOG_JSON_SSE2 1
+#elif defined(__aarch64__) and defined(__ARM_NEON)
+  #include <arm_neon.h>
+  #define XLOG_JSON_NEON 1
+#endif
+
+namespace xlog::detail {
+/// 每个字节的转义方式: 0 原样输出, 'u' 输出 \u00XX, 其他字符输出 '\' 加该字符
+inline constexpr auto json_escape_table = [] {
+  std::array<char, 256> table{};
+  for (int c = 0; c < 0x20; ++c) table[c] = 'u';
+  table['\b'] = 'b';
+  table['\f'] = 'f';
+  table['\n'] = 'n';
+  table['\r'] = 'r';
+  table['\t'] = 't';
+  table['"']  = '"';
+  table['\\'] = '\\';
+  return table;
+}();
+
+/// @brief 返回 [p, end) 中第一个需要转义的字节, 没有时返回 end.
+/// 有 SSE2/NEON 时每次比较 16 字节, 剩余部分查表
+inline const char* find_json_escape(const char* p, const char* end) {
+#if defined(XLOG_JSON_SSE2)
+  __m128i const quote = _mm_set1_epi8('"');
+  __m128i const slash = _mm_set1_epi8('\\');
+  __m128i const ctrl  = _mm_set1_epi8(0x1F);
+  for (; end - p >= 16; p += 16) {
+    __m128i const v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    // min(v, 0x1F) == v 即 v <= 0x1F(无符号)
+    __m128i const m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, slash)),
+                                   _mm_cmpeq_epi8(_mm_min_epu8(v, ctrl), v));
+    if (auto const bits = static_cast<unsigned>(_mm_movemask_epi8(m))) return p + std::countr_zero(bits);
+  }
+#elif defined(XLOG_JSON_NEON)
+  for (; end - p >= 16; p += 16) {
+    uint8x16_t const v = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+    uint8x16_t const m = vorrq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8('"')), vceqq_u8(v, vdupq_n_u8('\\'))),
+                                  vcleq_u8(v, vdupq_n_u8(0x1F)));
+    // 这 16 字节中有需要转义的, 交给下面逐字节定位
+    if (vmaxvq_u8(m) != 0) break;
+  }
+#endif
+  for (; p < end; ++p) {
+    if (json_escape_table[static_cast<uint8_t>(*p)]) return p;
+  }
+  return end;
+}
+
+/// @brief 把 str 转义后追加到 out(不含两侧引号); 非 ASCII 字节按 UTF-8 原样输出
+inline void append_json_escaped(std::string& out, std::string_view str) {
+  const char* p   = str.data();
+  const char* end = p + str.size();
+  while (p < end) {
+    const char* hit = find_json_escape(p, end);
+    out.append(p, hit);
+    if (hit == end) break;
+    auto const c   = static_cast<uint8_t>(*hit);
+    char const esc = json_escape_table[c];
+    if (esc == 'u') {
+      char buf[6] = {'\\', 'u', '0', '0', "0123456789abcdef"[c >> 4], "0123456789abcdef"[c & 0xF]};
+      out.append(buf, sizeof(buf));
+    } else {
+      char const buf[2] = {'\\', esc};
+      out.append(buf, sizeof(buf));
+    }
+    p = hit + 1;
+  }
+}
+
+inline void append_json_string(std::string& out, std::string_view str) {
+  out.push_back('"');
+  append_json_escaped(out, str);
+  out.push_back('"');
+}
+
+/// @brief 把一个字段值写成 JSON: 数字用 to_chars, 非有限浮点数写为 null, 指针写为字符串
+inline void append_json_value(std::string& out, const arg_value& arg) {
+  switch (arg.tag) {
+  case arg_tag::f64:
+    if (not std::isfinite(arg.f)) {
+      out.append("null");
+      break;
+    }
+    [[fallthrough]];
+  case arg_tag::i64:
+  case arg_tag::u64:
+  case arg_tag::boolean: append_arg(out, arg); break;
+  case arg_tag::character: append_json_string(out, std::string_view(&arg.c, 1)); break;
+  case arg_tag::string: append_json_string(out, arg.s); break;
+  case arg_tag::pointer:
+    out.push_back('"');
+    append_arg(out, arg);
+    out.push_back('"');
+    break;
+  default: out.append("null"); break;
+  }
+}
+
+/// @brief 每行一个 JSON 对象的布局:
+/// {"time":"2024-08-09T10:00:00.123456+08:00","level":"INFO","logger":"Main","thread":1234,
+///  "file":"main.cc","line":12,"function":"main","message":"...", 之后是 kv 字段}.
+/// 时间中到秒为止的部分和时区偏移按线程每秒渲染一次; 字段名与固定键重复时原样输出, 由下游决定取舍
+template<TimeZone Zone>
+struct json_line {
+  static void format(std::string& out, record_t& record) {
+    auto const since = record.getTimePoint().time_since_epoch();
+    auto const sec   = std::chrono::floor<std::chrono::seconds>(since);
+    auto const micros =
+        static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(since - sec).count());
+
+    thread_local int64_t last = INT64_MIN;
+    thread_local char    prefix[19]; // YYYY-MM-DDTHH:MM:SS
+    thread_local char    suffix[6];  // +08:00 或 Z
+    thread_local size_t  suffixLen = 0;
+    if (sec.count() != last) {
+      int32_t    offset;
+      auto const civil = time_util::civil_in<Zone>(sec.count(), offset);
+      char*      p     = time_util::write_digits<4>(prefix, static_cast<uint32_t>(civil.year));
+      *p++             = '-';
+      p                = time_util::write_digits<2>(p, civil.month);
+      *p++             = '-';
+      p                = time_util::write_digits<2>(p, civil.day);
+      *p++             = 'T';
+      p                = time_util::write_digits<2>(p, civil.hour);
+      *p++             = ':';
+      p                = time_util::write_digits<2>(p, civil.minute);
+      *p++             = ':';
+      time_util::write_digits<2>(p, civil.second);
+      if constexpr (Zone == TimeZone::UTC) {
+        suffix[0] = 'Z';
+        suffixLen = 1;
+      } else {
+        suffixLen = time_util::write_utc_offset(suffix, offset) - suffix;
+      }
+      last = sec.count();
+    }
+
+    char fraction[7] = {'.'};
+    time_util::write_digits<6>(fraction + 1, micros);
+
+    out.append(R"({"time":")");
+    out.append(prefix, sizeof(prefix)).append(fraction, sizeof(fraction)).append(suffix, suffixLen);
+    out.append(R"(","level":")");
+    std::string_view const level = helper::LevelStr(record.getLevel());
+    out.append(level.substr(0, level.find(' ')));
+    out.append(R"(","logger":)");
+    append_json_string(out, record.getLoggerName());
+
+    char buf[16];
+    out.append(R"(,"thread":)");
+    out.append(buf, std::to_chars(buf, buf + sizeof(buf), record.getThreadId()).ptr);
+    auto const& site = record.getSite();
+    out.append(R"(,"file":)");
+    append_json_string(out, site.file);
+    out.append(R"(,"line":)");
+    out.append(buf, std::to_chars(buf, buf + sizeof(buf), site.line).ptr);
+    out.append(R"(,"function":)");
+    append_json_string(out, site.function);
+    out.append(R"(,"message":)");
+    append_json_string(out, record.getMessage());
+
+    for_each_field(record.getFields(), [&](std::string_view key, const arg_value& value) {
+      out.push_back(',');
+      append_json_string(out, key);
+      out.push_back(':');
+      append_json_value(out, value);
+    });
+    out.append("}\n");
+  }
+};
+
+/// JSON 布局不着色, 文件和控制台输出相同的内容
+template<TimeZone Zone>
+constexpr inline line_layout json_layout{&json_line<Zone>::format, &json_line<Zone>::format};
+} // namespace xlog::detail
+
+#endif // XLOG_JSON_HH
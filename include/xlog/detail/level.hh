@@ -6,6 +6,8 @@
 #ifndef XLOG_LEVEL_HH
 #define XLOG_LEVEL_HH
 
+#include "xlog/detail/config.hh"
+
 namespace xlog {
 
 enum class Level {
@@ -18,6 +20,9 @@ enum class Level {
   FATAL,
 };
 
+/// 编译期的最低等级, 低于它的日志语句连同参数求值一起被编译器丢弃
+constexpr inline Level active_level = static_cast<Level>(XLOG_ACTIVE_LEVEL);
+
 } // xhl
 
 #endif //XLOG_LEVEL_HH
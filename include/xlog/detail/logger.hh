@@ -20,10 +20,13 @@
 #endif
 
 #include "xlog/detail/config.hh"
+#include "xlog/detail/crash.hh"
 #include "xlog/detail/record.hh"
+#include "xlog/detail/registry.hh"
 #include "xlog/detail/sink.hh"
 #include "xlog/detail/util.hh"
 
+#include <atomic>
 #include <functional>
 #include <string_view>
 #include <utility>
@@ -58,10 +61,29 @@ public:
 
   virtual void init(Level minLevel, bool async, bool console,
                     std::string const& filename, size_t fileMaxSize,
-                    size_t maxFileCount, bool alwaysFlush) = 0;
+                    size_t maxFileCount, bool alwaysFlush,
+                    size_t bufferSize) = 0;
+  /// 以内存映射追加模式初始化(同步, 无写线程)
+  virtual void initMapped(Level minLevel, bool console, std::string const& filename,
+                          size_t segmentSize, size_t maxFileCount) = 0;
 
-  /// 只有当 level ≥ 最低level才进行日志记录
-  [[nodiscard]] virtual bool checkLevel(Level level) const = 0;
+  /// 只有当 level ≥ 最低level才进行日志记录, 非虚函数, 只有一次 relaxed 原子读
+  [[nodiscard]] bool checkLevel(Level level) const {
+    return level >= minLevel_.value.load(std::memory_order_relaxed);
+  }
+  /// 按当前时钟模式取时间戳, 非虚函数, 日志宏在调用线程上调用
+  [[nodiscard]] log_stamp now() const {
+    return detail::stamp_now(minLevel_.clock.load(std::memory_order_relaxed));
+  }
+  /// @brief 设置时间戳来源; 切换到 TSC 时先在当前线程完成初次校准, 并更新崩溃处理用的换算参数
+  void setClockMode(ClockMode mode) {
+    if (mode == ClockMode::TSC) {
+      detail::tsc_clock::instance();
+      detail::snapshot_crash_tsc();
+    }
+    minLevel_.clock.store(mode, std::memory_order_relaxed);
+  }
+  [[nodiscard]] ClockMode clockMode() const { return minLevel_.clock.load(std::memory_order_relaxed); }
   /// 添加日志下游流向
   virtual void addSink(std::function<void(std::string_view)> fn) = 0;
 
@@ -69,12 +91,24 @@ public:
   virtual void                stopAsyncLog() const           = 0;
   virtual void                setMinLevel(Level level)       = 0;
   virtual void                setConsole(bool enabled)       = 0;
+  virtual void                setRollMode(RollMode mode)     = 0;
+  virtual void                setRollInterval(RollInterval interval) = 0;
+  virtual Compression         setCompression(Compression method)     = 0;
+  virtual void setOverflowPolicy(size_t capacity, OverflowPolicy policy, std::chrono::milliseconds timeout,
+                                 Level threshold)                       = 0;
+  [[nodiscard]] virtual overflow_stats overflowStats() const          = 0;
+  virtual void setLayout(const detail::line_layout* layout)            = 0;
+  virtual bool setBinaryFormat(bool enable)                           = 0;
+  virtual bool setIndexInterval(size_t interval)                      = 0;
+  virtual void setDedupWindow(std::chrono::milliseconds window)       = 0;
   virtual void                setAsync(bool asynced)         = 0;
   virtual void                setName(std::string_view name) = 0;
   virtual void                setHash(size_t const& id)      = 0;
   [[nodiscard]] virtual Level getMinLevel() const            = 0;
   [[nodiscard]] virtual bool  isAsynced() const              = 0;
   [[nodiscard]] virtual bool  consoleEnabled() const         = 0;
+  [[nodiscard]] std::string_view getName() const { return *loggerName_.load(std::memory_order_acquire); }
+  [[nodiscard]] Sink::sptr       sink() const { return pSink_; }
 
 protected:
   void appendRecord(record_t record) const { pSink_->write(std::move(record)); }
@@ -86,47 +120,39 @@ protected:
       pSink_->writeRecord<true, false>(record);
     }
   }
-  Level minLevel_ =
+  /// 最低等级和时钟模式独占一个 cache line, 其他线程修改相邻字段时不会干扰日志宏的读取
+  struct alignas(detail::cache_line_size) level_slot {
+    std::atomic<Level>     value;
+    std::atomic<ClockMode> clock{ClockMode::SYSTEM};
+  };
+  level_slot minLevel_{
 #if NDEBUG
-    Level::WARN;
+    Level::WARN
 #else
-    Level::TRACE;
+    Level::TRACE
 #endif
+  };
   bool        async_         = false;
   bool        enableConsole_ = true;
   Sink::sptr  pSink_         = nullptr;
-  std::string loggerName_    = {};
+  /// intern_string 返回的池中字符串, 记录直接引用它; 改名时整体替换, 写日志的线程看到旧名或新名
+  std::atomic<const std::string*> loggerName_{detail::intern_string({})};
   size_t      id_            = 0;
   /// 其他下游日志消息消费者
   std::vector<std::function<void(std::string_view)>> sinks_;
 };
 
-template <size_t ID = hashed(logger_default_name)>
-class Logger final : public ILogger {
-  using ptr = std::shared_ptr<Logger>;
-
+/// @brief ILogger 的实现, 编译期命名的 Logger<ID> 和运行期创建的 logger 共用
+class BasicLogger : public ILogger {
 public:
-  static ILogger::sptr
-  Instance(std::string_view name = logger_default_name) {
-    DEV_DEBUG(std::cout << __FUNCTION__ << "  " << ID << "  " << hashed(name)
-                        << "\n");
-    if (allLoggers.contains(ID)) [[likely]] {
-      DEV_DEBUG(std::cout << __FUNCTION__ << "  " << name << "  contain\n");
-      return allLoggers.at(ID);
-    }
-    DEV_DEBUG(std::cout << __FUNCTION__ << "  " << name << "  NO contain\n");
-    static auto instance{ Logger::createInstance() };
-    instance->setName(name);
-    instance->setHash(hashed(name));
-    ILogger::sptr baseInstance{ std::dynamic_pointer_cast<ILogger>(instance) };
-    allLoggers.insert_or_assign(hashed(name), baseInstance);
-    return baseInstance;
+  /// @brief 创建一个运行期 logger, 共用 sink 作为输出(sink 为空时输出到控制台)
+  static ILogger::sptr create(std::string_view name, Sink::sptr sink, bool async) {
+    return ILogger::sptr{ new BasicLogger(hashed(name), name, std::move(sink), async) };
   }
 
   ///@brief 进行日志记录
   void log(record_t& record) const override {
-    record.setLoggerName(loggerName_);
-    record.setLoggerId(ID);
+    record.setLoggerName(*loggerName_.load(std::memory_order_acquire));
     if (async_ and pSink_) {
       appendRecord(std::move(record));
     } else {
@@ -144,28 +170,62 @@ public:
   }
   void init(Level minLevel, bool async, bool console,
             std::string const& filename, size_t fileMaxSize,
-            size_t maxFileCount, bool alwaysFlush) override {
+            size_t maxFileCount, bool alwaysFlush,
+            size_t bufferSize) override {
     pSink_    = std::make_shared<Sink>(filename, async, console, fileMaxSize,
-                                    maxFileCount, alwaysFlush);
-    pSink_->stop();
+                                    maxFileCount, alwaysFlush, bufferSize);
     async_    = async;
-    minLevel_ = minLevel;
+    minLevel_.value.store(minLevel, std::memory_order_relaxed);
     enableConsole_ = console;
   }
-  /// 只有当 level ≥ 最低level才进行日志记录
-  [[nodiscard]] bool checkLevel(const Level level) const override {
-    return level >= minLevel_;
+  void initMapped(Level minLevel, bool console, std::string const& filename,
+                  size_t segmentSize, size_t maxFileCount) override {
+#ifndef _WIN32
+    pSink_ = std::make_shared<Sink>(filename, console, segmentSize, maxFileCount);
+    async_ = false;
+#else
+    pSink_ = std::make_shared<Sink>(filename, false, console, segmentSize,
+                                    maxFileCount, false);
+#endif
+    minLevel_.value.store(minLevel, std::memory_order_relaxed);
+    enableConsole_ = console;
   }
   /// 停止异步日志线程
   void stopAsyncLog() const override { pSink_->stop(); }
-  void setMinLevel(const Level level) override { minLevel_ = level; }
+  void setMinLevel(const Level level) override {
+    minLevel_.value.store(level, std::memory_order_relaxed);
+  }
   void setAsync(const bool asynced) override { async_ = asynced; }
   void setConsole(const bool enabled) override {
     enableConsole_ = enabled;
     if (pSink_) pSink_->enableConsole(enabled);
   }
+  void setRollMode(const RollMode mode) override {
+    if (pSink_) pSink_->setRollMode(mode);
+  }
+  void setRollInterval(const RollInterval interval) override {
+    if (pSink_) pSink_->setRollInterval(interval);
+  }
+  Compression setCompression(const Compression method) override {
+    return pSink_ ? pSink_->setCompression(method) : Compression::NONE;
+  }
+  void setOverflowPolicy(size_t capacity, OverflowPolicy policy, std::chrono::milliseconds timeout,
+                         Level threshold) override {
+    if (pSink_) pSink_->setOverflowPolicy(capacity, policy, timeout, threshold);
+  }
+  [[nodiscard]] overflow_stats overflowStats() const override {
+    return pSink_ ? pSink_->overflowStats() : overflow_stats{};
+  }
+  bool setBinaryFormat(bool enable) override { return pSink_ and pSink_->setBinaryFormat(enable); }
+  bool setIndexInterval(size_t interval) override { return pSink_ and pSink_->setIndexInterval(interval); }
+  void setDedupWindow(std::chrono::milliseconds window) override {
+    if (pSink_) pSink_->setDedupWindow(window);
+  }
+  void setLayout(const detail::line_layout* layout) override {
+    if (pSink_) pSink_->setLayout(layout);
+  }
   void setName(std::string_view name) override {
-    loggerName_ = std::string(name);
+    loggerName_.store(detail::intern_string(name), std::memory_order_release);
   }
   void setHash(size_t const& id) override { id_ = id; }
   /// 添加日志下游流向
@@ -174,24 +234,79 @@ public:
   }
   [[nodiscard]] bool  consoleEnabled() const override { return enableConsole_; }
   [[nodiscard]] bool  isAsynced() const override { return async_; }
-  [[nodiscard]] Level getMinLevel() const override { return minLevel_; }
+  [[nodiscard]] Level getMinLevel() const override {
+    return minLevel_.value.load(std::memory_order_relaxed);
+  }
+
+  ~BasicLogger() override = default;
+
+protected:
+  BasicLogger(size_t id, std::string_view name, Sink::sptr sink, bool async)
+      : ILogger{} {
+    id_         = id;
+    loggerName_.store(detail::intern_string(name), std::memory_order_relaxed);
+    pSink_      = sink ? std::move(sink) : std::make_shared<Sink>();
+    async_      = async;
+  }
+};
+
+template <size_t ID = hashed(logger_default_name)>
+class Logger final : public BasicLogger {
+public:
+  /// @brief 获取(首次调用时创建)实例并登记到全局注册表
+  /// @param name logger 的名字; 非默认 ID 先被不带名字的 api 函数创建时暂用默认名字,
+  /// 第一次用匹配的名字调用时更正一次, 之后不再修改
+  static ILogger::sptr
+  Instance(std::string_view name = logger_default_name) {
+    static auto instance{ Logger::createInstance(name) };
+    DEV_DEBUG(std::cout << __FUNCTION__ << "  " << ID << "  " << hashed(name) << "\n");
+    if constexpr (ID != hashed(logger_default_name)) {
+      if (not named_.load(std::memory_order_relaxed)) [[unlikely]] { settleName(*instance, name); }
+    }
+    return instance;
+  }
+
+  /// @brief 不带引用计数的实例指针, 缓存在函数内的静态变量中,
+  /// 名字确定之后只有一次指针读取, 日志宏通过它访问 logger
+  static ILogger* getInstance(std::string_view name = logger_default_name) {
+    static ILogger* const instance = Instance(name).get();
+    if constexpr (ID != hashed(logger_default_name)) {
+      if (not named_.load(std::memory_order_relaxed)) [[unlikely]] { settleName(*instance, name); }
+    }
+    return instance;
+  }
+
+  /// @brief 该 logger 在注册表中的整数句柄, 与 getLogger(name) 返回的相同
+  static logger_handle handle() {
+    static logger_handle const h = (getInstance(), registry().find(ID));
+    return h;
+  }
 
   ~Logger() override = default;
 
 private:
-  static Logger<ID>::sptr createInstance() {
-    static auto* instance{ new Logger<ID>{} };
-    return Logger<ID>::sptr{ instance };
+  static ILogger::sptr createInstance(std::string_view name) {
+    // 运行期已用同名(同 hash)创建过的 logger 直接复用
+    logger_handle h = registry().add(ID, [&] {
+      return ILogger::sptr{ new Logger<ID>{ name } };
+    });
+    // 注册表已满时不登记, getLogger(name) 找不到它, 但 Logger<ID> 本身照常可用
+    if (auto owner = registry().owner(h)) { return owner; }
+    return ILogger::sptr{ new Logger<ID>{ name } };
   }
 
-  Logger()
-      : ILogger{} {
-    pSink_ = std::make_shared<Sink>();
-    async_ = true;
+  /// 只更正默认的占位名字, 名字与 ID 不匹配时不算数
+  static void settleName(ILogger& logger, std::string_view name) {
+    if (hashed(name) != ID) return;
+    if (logger.getName() == logger_default_name) logger.setName(name);
+    named_.store(true, std::memory_order_relaxed);
   }
 
-  Logger(const Logger&) = default;
+  explicit Logger(std::string_view name)
+      : BasicLogger(ID, name, nullptr, true) {}
 
+  /// 名字已与 ID 一致
+  inline static std::atomic<bool> named_{false};
 };
 } // xhl
 
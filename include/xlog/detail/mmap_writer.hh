@@ -0,0 +1,270 @@
+//
+// xlog / mmap_writer.hh
+// Created by brian on 2024-07-24.
+//
+
+#ifndef XLOG_MMAP_WRITER_HH
+#define XLOG_MMAP_WRITER_HH
+
+#include "xlog/detail/segment.hh"
+
+#ifndef _WIN32
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace xlog {
+#ifndef _WIN32
+/// @brief 生产者直接写入内存映射日志段的追加器
+///
+/// 每个生产者用 fetch_add 在当前段上预留空间后直接 memcpy, 不加锁也不经过写线程.
+/// 日志段按 stem.N.ext 单调编号, 后台整理线程负责提前 fallocate + mmap 下一个段,
+/// 并在段写满后截断到有效长度、解除映射以及删除超出数量限制的旧段.
+/// 数据写入 MAP_SHARED 映射即进入 page cache, 进程崩溃也不会丢失.
+class mmap_appender {
+  struct segment {
+    int                   fd       = -1;
+    char*                 base     = nullptr;
+    size_t                capacity = 0;
+    uint64_t              seq      = 0;
+    std::string           path;
+    std::atomic<size_t>   offset{0};
+    std::atomic<uint32_t> writers{0};
+    size_t                validSize = 0;
+  };
+
+public:
+  mmap_appender(std::string filename, size_t segmentSize, size_t maxFileCount,
+                std::string_view header = {})
+      : filename_(std::move(filename))
+      , segmentSize_(segmentSize)
+      , maxFileCount_(maxFileCount)
+      , header_(header) {
+    nextSeq_ = last_segment_seq(filename_) + 1; // 重启后继续递增
+    current_.store(createSegment(), std::memory_order_release);
+    housekeeper_ = std::thread([this] { housekeep(); });
+  }
+
+  mmap_appender(const mmap_appender&)            = delete;
+  mmap_appender& operator=(const mmap_appender&) = delete;
+
+  ~mmap_appender() {
+    {
+      std::lock_guard guard(mtx_);
+      stopped_ = true;
+    }
+    cnd_.notify_all();
+    housekeeper_.join();
+    if (segment* seg = current_.load(std::memory_order_acquire)) {
+      seg->validSize = (std::min)(seg->offset.load(), seg->capacity);
+      finalize(seg);
+      graveyard_.emplace_back(seg);
+    }
+    if (prepared_) {
+      prepared_->validSize = 0;
+      finalize(prepared_);
+      std::error_code ec;
+      std::filesystem::remove(prepared_->path, ec);
+      graveyard_.emplace_back(prepared_);
+    }
+  }
+
+  /// 当前段是否创建成功
+  bool good() const { return current_.load(std::memory_order_acquire) != nullptr; }
+
+  /// @brief 追加一段数据, 可被任意线程并发调用
+  /// @return 数据超过单个段大小或无法创建新段时返回 false
+  bool append(std::string_view data) {
+    if (data.size() + header_.size() > segmentSize_) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    for (;;) {
+      segment* seg = current_.load(std::memory_order_seq_cst);
+      if (seg == nullptr and (seg = installPrepared()) == nullptr) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      seg->writers.fetch_add(1, std::memory_order_seq_cst);
+      // 段可能已在加计数之前被替换, 此时不能再访问它的映射
+      if (current_.load(std::memory_order_seq_cst) != seg) {
+        seg->writers.fetch_sub(1, std::memory_order_release);
+        continue;
+      }
+      size_t const start = seg->offset.fetch_add(data.size(), std::memory_order_relaxed);
+      if (start + data.size() <= seg->capacity) {
+        std::memcpy(seg->base + start, data.data(), data.size());
+        seg->writers.fetch_sub(1, std::memory_order_release);
+        return true;
+      }
+      seg->writers.fetch_sub(1, std::memory_order_release);
+      if (start <= seg->capacity) {
+        // 唯一一个越过段尾的预留负责切换到下一个段, start 之前的数据都是完整的
+        seg->validSize = start;
+        switchSegment(seg);
+      } else {
+        while (current_.load(std::memory_order_acquire) == seg) std::this_thread::yield();
+      }
+    }
+  }
+
+  /// 因超长或无法创建日志段而被丢弃的条数
+  size_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+  /// @brief 设置写满的段交给哪个压缩线程, nullptr 表示不压缩
+  void setCompressor(segment_compressor* compressor) {
+    std::lock_guard guard(mtx_);
+    compressor_ = compressor;
+  }
+
+  /// 当前段的文件名
+  std::string currentPath() const {
+    std::lock_guard guard(mtx_);
+    segment* seg = current_.load(std::memory_order_acquire);
+    return seg ? seg->path : std::string{};
+  }
+
+private:
+  void switchSegment(segment* full) {
+    segment* next = nullptr;
+    {
+      std::lock_guard guard(mtx_);
+      next      = prepared_;
+      prepared_ = nullptr;
+    }
+    // 后台线程还没来得及准备好时只能由当前线程同步创建
+    if (next == nullptr) next = createSegment();
+    current_.store(next, std::memory_order_seq_cst);
+    {
+      std::lock_guard guard(mtx_);
+      retired_.push_back(full);
+    }
+    cnd_.notify_all();
+  }
+
+  /// 之前创建段失败时, 尝试换上后台线程重新准备好的段
+  segment* installPrepared() {
+    std::lock_guard guard(mtx_);
+    segment*        expected = nullptr;
+    if (prepared_ != nullptr and current_.compare_exchange_strong(expected, prepared_)) {
+      prepared_ = nullptr;
+      cnd_.notify_all();
+      return current_.load();
+    }
+    return expected;
+  }
+
+  void housekeep() {
+    std::unique_lock lock(mtx_);
+    for (;;) {
+      cnd_.wait(lock, [this] { return stopped_ or not retired_.empty() or prepared_ == nullptr; });
+      if (stopped_) break;
+      if (prepared_ == nullptr) {
+        lock.unlock();
+        segment* seg = createSegment();
+        lock.lock();
+        prepared_ = seg;
+        if (seg == nullptr) { cnd_.wait_for(lock, std::chrono::seconds(1)); }
+      }
+      while (not retired_.empty()) {
+        segment* seg = retired_.front();
+        retired_.pop_front();
+        lock.unlock();
+        while (seg->writers.load(std::memory_order_seq_cst) != 0) std::this_thread::yield();
+        finalize(seg);
+        removeExpired(seg->seq);
+        lock.lock();
+        if (compressor_) compressor_->enqueue(seg->path);
+        // 可能还有生产者持有旧段指针(但不会再访问映射), 结构体留到析构时释放
+        graveyard_.emplace_back(seg);
+      }
+    }
+    while (not retired_.empty()) {
+      segment* seg = retired_.front();
+      retired_.pop_front();
+      while (seg->writers.load(std::memory_order_seq_cst) != 0) std::this_thread::yield();
+      finalize(seg);
+      graveyard_.emplace_back(seg);
+    }
+  }
+
+  segment* createSegment() {
+    uint64_t const seq  = nextSeq_.fetch_add(1, std::memory_order_relaxed);
+    auto           seg  = std::make_unique<segment>();
+    seg->seq            = seq;
+    seg->path           = segment_name(filename_, seq);
+    seg->capacity       = segmentSize_;
+    if (auto parent = std::filesystem::path(seg->path).parent_path(); not parent.empty()) {
+      std::error_code ec;
+      std::filesystem::create_directories(parent, ec);
+    }
+    seg->fd = ::open(seg->path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (seg->fd < 0) return nullptr;
+  #ifdef __linux__
+    int const rc = ::posix_fallocate(seg->fd, 0, static_cast<off_t>(segmentSize_));
+  #else
+    int const rc = ::ftruncate(seg->fd, static_cast<off_t>(segmentSize_));
+  #endif
+    void* base = rc == 0 ? ::mmap(nullptr, segmentSize_, PROT_READ | PROT_WRITE, MAP_SHARED,
+                                  seg->fd, 0)
+                         : MAP_FAILED;
+    if (base == MAP_FAILED) {
+      ::close(seg->fd);
+      std::error_code ec;
+      std::filesystem::remove(seg->path, ec);
+      return nullptr;
+    }
+    seg->base = static_cast<char*>(base);
+    std::memcpy(seg->base, header_.data(), header_.size());
+    seg->offset.store(header_.size(), std::memory_order_relaxed);
+    return seg.release();
+  }
+
+  /// 解除映射并把文件截断到有效长度, 去掉 fallocate 预留的尾部空间
+  static void finalize(segment* seg) {
+    ::munmap(seg->base, seg->capacity);
+    if (::ftruncate(seg->fd, static_cast<off_t>(seg->validSize)) != 0) {}
+    ::close(seg->fd);
+  }
+
+  void removeExpired(uint64_t seq) {
+    if (maxFileCount_ == 0 or seq < maxFileCount_) return;
+    remove_segment(segment_name(filename_, seq + 1 - maxFileCount_));
+  }
+
+  std::string const filename_;
+  size_t const      segmentSize_;
+  size_t const      maxFileCount_;
+  std::string const header_;
+
+  alignas(64) std::atomic<segment*> current_{nullptr};
+  std::atomic<uint64_t> nextSeq_{1};
+  std::atomic<size_t>   dropped_{0};
+
+  mutable std::mutex      mtx_;
+  std::condition_variable cnd_;
+  segment*                prepared_ = nullptr;
+  segment_compressor*     compressor_ = nullptr;
+  std::deque<segment*>    retired_;
+  std::vector<std::unique_ptr<segment>> graveyard_;
+  bool                    stopped_ = false;
+  std::thread             housekeeper_;
+};
+#endif
+} // namespace xlog
+
+#endif // XLOG_MMAP_WRITER_HH
@@ -0,0 +1,428 @@
+//
+// xlog / pattern.hh
+// Created by brian on 2024-08-06.
+//
+
+#ifndef XLOG_PATTERN_HH
+#define XLOG_PATTERN_HH
+
+#include "xlog/detail/record.hh"
+#include "xlog/detail/time_util.hh"
+#include "xlog/vendor/meta_string.hpp"
+
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace xlog {
+namespace helper {
+/// @brief 日志等级对应的字符串
+/// @param level 等级 enum
+/// @return 长度为 6 的字符串
+inline std::string_view LevelStr(Level level) {
+  switch (level) {
+  //@format:off
+  case Level::TRACE:
+    return "TRACE ";
+  case Level::DEBUG:
+    return "DEBUG ";
+  case Level::INFO:
+    return "INFO  ";
+  case Level::WARN:
+    return "WARN  ";
+  case Level::ERROR:
+    return "ERROR ";
+  case Level::FATAL:
+    return "FATAL ";
+  default:
+    return "NONE  ";
+    // @format:on
+  }
+}
+
+#ifdef _WIN32
+enum class color_type : int {
+  none  = -1,
+  black = 0,
+  blue,
+  green,
+  cyan,
+  red,
+  magenta,
+  yellow,
+  white,
+  black_bright,
+  blue_bright,
+  green_bright,
+  cyan_bright,
+  red_bright,
+  magenta_bright,
+  yellow_bright,
+  white_bright
+};
+
+inline void windows_set_color(color_type fg, color_type bg) {
+  auto handle = GetStdHandle(STD_OUTPUT_HANDLE);
+  if (handle != nullptr) {
+    CONSOLE_SCREEN_BUFFER_INFO info{};
+    auto status = GetConsoleScreenBufferInfo(handle, &info);
+    if (status) {
+      WORD color = info.wAttributes;
+      if (fg != color_type::none) { color = (color & 0xFFF0) | int(fg); }
+      if (bg != color_type::none) { color = (color & 0xFF0F) | int(bg) << 4; }
+      SetConsoleTextAttribute(handle, color);
+    }
+  }
+}
+#endif
+
+inline std::string_view addColor(Level level) {
+#if defined(_WIN32)
+  if (level == Level::WARN)
+    windows_set_color(color_type::black, color_type::yellow);
+  if (level == Level::ERROR)
+    windows_set_color(color_type::black, color_type::red);
+  if (level == Level::FATAL)
+    windows_set_color(color_type::white_bright, color_type::red);
+#elif __APPLE__
+#else
+  if (level == Level::WARN) return "\x1B[93;1m";
+  if (level == Level::ERROR) return "\x1B[91;1m";
+  if (level == Level::FATAL) return "\x1B[97;1m\x1B[41m";
+#endif
+  return {};
+}
+
+inline std::string_view cleanColor(Level level) {
+#if defined(_WIN32)
+  if (level >= Level::WARN)
+    windows_set_color(color_type::white, color_type::black);
+#elif __APPLE__
+#else
+  if (level >= Level::WARN) return "\x1B[0m\x1B[0K";
+#endif
+  return {};
+}
+} // namespace helper
+
+namespace detail {
+/// @brief 格式串中的一个占位符
+enum class pattern_flag : uint8_t {
+  literal,
+  year,        // %Y 4 位年份
+  month,       // %m 01-12
+  day,         // %d 01-31
+  hour,        // %H 00-23
+  minute,      // %M 00-59
+  second,      // %S 00-60
+  date,        // %D 等同 %Y-%m-%d
+  clock,       // %T 等同 %H:%M:%S
+  utc_offset,  // %z 相对 UTC 的偏移, RFC 3339 形式 +08:00
+  epoch,       // %E unix 秒数
+  millis,      // %e 毫秒, 3 位
+  micros,      // %f 微秒, 6 位
+  nanos,       // %F 纳秒, 9 位
+  level,       // %l 等级, 补齐到 6 个字符
+  level_short, // %L 等级首字母
+  name,        // %n logger 名字
+  thread,      // %t 线程 ID
+  location,    // %s 文件名:行号
+  file,        // %g 文件名
+  line,        // %# 行号
+  function,    // %! 函数名
+  message,     // %v 日志内容
+  fields,      // %k 结构化字段, 每个输出为 " key=value"
+  color_begin, // %^ 控制台上从这里开始按等级着色
+  color_end,   // %$ 着色结束
+};
+
+/// @brief 解析后的一步: 占位符, 或格式串中 [offset, offset + length) 的原样文本
+struct pattern_step {
+  pattern_flag flag   = pattern_flag::literal;
+  uint16_t     offset = 0;
+  uint16_t     length = 0;
+};
+
+constexpr pattern_flag pattern_flag_of(char c) {
+  switch (c) {
+  case 'Y': return pattern_flag::year;
+  case 'm': return pattern_flag::month;
+  case 'd': return pattern_flag::day;
+  case 'H': return pattern_flag::hour;
+  case 'M': return pattern_flag::minute;
+  case 'S': return pattern_flag::second;
+  case 'D': return pattern_flag::date;
+  case 'T': return pattern_flag::clock;
+  case 'z': return pattern_flag::utc_offset;
+  case 'E': return pattern_flag::epoch;
+  case 'e': return pattern_flag::millis;
+  case 'f': return pattern_flag::micros;
+  case 'F': return pattern_flag::nanos;
+  case 'l': return pattern_flag::level;
+  case 'L': return pattern_flag::level_short;
+  case 'n': return pattern_flag::name;
+  case 't': return pattern_flag::thread;
+  case 's': return pattern_flag::location;
+  case 'g': return pattern_flag::file;
+  case '#': return pattern_flag::line;
+  case '!': return pattern_flag::function;
+  case 'v': return pattern_flag::message;
+  case 'k': return pattern_flag::fields;
+  case '^': return pattern_flag::color_begin;
+  case '$': return pattern_flag::color_end;
+  // 未知的占位符在常量求值中抛出, 表现为编译错误
+  default: throw "xlog: unknown pattern flag";
+  }
+}
+
+/// @brief 把格式串解析为步骤序列, out 为空时只计数
+constexpr size_t parse_pattern(std::string_view pattern, pattern_step* out) {
+  size_t count   = 0;
+  size_t literal = 0;
+  auto   emit    = [&](pattern_step step) {
+    if (out) out[count] = step;
+    ++count;
+  };
+  auto flush = [&](size_t end) {
+    if (end > literal) {
+      emit({pattern_flag::literal, static_cast<uint16_t>(literal), static_cast<uint16_t>(end - literal)});
+    }
+  };
+  for (size_t i = 0; i < pattern.size(); ++i) {
+    if (pattern[i] != '%') continue;
+    if (i + 1 == pattern.size()) throw "xlog: dangling '%' at the end of pattern";
+    flush(i);
+    if (pattern[i + 1] == '%') {
+      // "%%" 输出一个 '%': 作为下一段原样文本的开头
+      literal = i + 1;
+    } else {
+      emit({pattern_flag_of(pattern[i + 1])});
+      literal = i + 2;
+    }
+    ++i;
+  }
+  flush(pattern.size());
+  return count;
+}
+
+/// 同一秒内输出不变的时间占位符
+constexpr bool is_second_flag(pattern_flag flag) {
+  return flag >= pattern_flag::year and flag <= pattern_flag::epoch and flag != pattern_flag::millis and
+         flag != pattern_flag::micros and flag != pattern_flag::nanos;
+}
+
+constexpr bool is_time_flag(pattern_flag flag) {
+  return flag >= pattern_flag::year and flag <= pattern_flag::epoch;
+}
+
+template<int Width>
+inline void append_digits(std::string& out, uint32_t value) {
+  char buf[Width];
+  time_util::write_digits<Width>(buf, value);
+  out.append(buf, Width);
+}
+
+/// 一条记录在格式化过程中用到的时间字段
+struct pattern_time {
+  int64_t                sec    = 0;
+  uint32_t               nanos  = 0;
+  int32_t                offset = 0;
+  time_util::civil_time  civil;
+};
+
+/// @brief 编译期解析的行格式.
+/// Pattern 在编译期被拆成固定的步骤序列, 每一步都是模板常量, 格式化一条记录时没有解释开销
+/// 格式串中第一段只由秒级时间占位符和原样文本组成的步骤(例如 "%Y-%m-%d %H:%M:%S")按线程缓存,
+/// 每秒只渲染一次, 同一秒内的记录直接拷贝; 亚秒字段每条记录用两位数字查表写出
+/// @tparam Pattern 例如 "%Y-%m-%d %H:%M:%S.%e %l [%n] %v"
+/// @tparam Zone    时间按本地时区还是 UTC 输出
+template<refvalue::meta_string Pattern, TimeZone Zone = TimeZone::LOCAL>
+struct pattern {
+  static constexpr std::string_view text = Pattern;
+  static constexpr size_t           size = parse_pattern(text, nullptr);
+  static constexpr auto             steps = [] {
+    std::array<pattern_step, size> result{};
+    parse_pattern(text, result.data());
+    return result;
+  }();
+  static constexpr bool uses_time = [] {
+    for (auto const& step : steps) {
+      if (is_time_flag(step.flag)) return true;
+    }
+    return false;
+  }();
+  /// 按秒缓存的步骤区间 [first, second), 没有秒级占位符时为空
+  static constexpr auto cached = [] {
+    for (size_t i = 0; i < size; ++i) {
+      if (not is_second_flag(steps[i].flag)) continue;
+      size_t begin = i, end = i;
+      while (begin > 0 and steps[begin - 1].flag == pattern_flag::literal) --begin;
+      while (end < size and (steps[end].flag == pattern_flag::literal or is_second_flag(steps[end].flag))) ++end;
+      return std::pair<size_t, size_t>{begin, end};
+    }
+    return std::pair<size_t, size_t>{size, size};
+  }();
+  /// 缓存区间之外还有秒级占位符时, 每条记录都要换算公历时间
+  static constexpr bool needs_civil = [] {
+    for (size_t i = cached.second; i < size; ++i) {
+      if (is_second_flag(steps[i].flag)) return true;
+    }
+    return false;
+  }();
+
+  /// @brief 按格式把一条记录追加到 out, 末尾加换行
+  /// @tparam colored 为 true 时在 %^ / %$ 处插入控制台颜色
+  template<bool colored>
+  static void format(std::string& out, record_t& record) {
+    pattern_time time;
+    if constexpr (uses_time) {
+      auto const since = record.getTimePoint().time_since_epoch();
+      auto const sec   = std::chrono::floor<std::chrono::seconds>(since);
+      time.sec         = sec.count();
+      time.nanos = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(since - sec).count());
+      if constexpr (needs_civil) { time.civil = time_util::civil_in<Zone>(time.sec, time.offset); }
+    }
+    [&]<size_t... I>(std::index_sequence<I...>) {
+      (emit_at<I, colored>(out, record, time), ...);
+    }(std::make_index_sequence<size>{});
+    out.push_back('\n');
+  }
+
+private:
+  template<size_t I, bool colored>
+  static void emit_at(std::string& out, record_t& record, const pattern_time& time) {
+    if constexpr (I == cached.first) {
+      out.append(cached_text(record, time));
+    } else if constexpr (I < cached.first or I >= cached.second) {
+      emit<steps[I], colored>(out, record, time);
+    }
+  }
+
+  /// @brief 当前线程上一秒渲染好的缓存区间, 换秒时重新渲染
+  static std::string_view cached_text(record_t& record, const pattern_time& time) {
+    thread_local int64_t     last = INT64_MIN;
+    thread_local std::string text;
+    if (time.sec != last) {
+      pattern_time full = time;
+      full.civil        = time_util::civil_in<Zone>(time.sec, full.offset);
+      text.clear();
+      [&]<size_t... I>(std::index_sequence<I...>) {
+        (emit<steps[cached.first + I], false>(text, record, full), ...);
+      }(std::make_index_sequence<cached.second - cached.first>{});
+      last = time.sec;
+    }
+    return text;
+  }
+
+  template<pattern_step step, bool colored>
+  static void emit(std::string& out, record_t& record, const pattern_time& time) {
+    constexpr pattern_flag flag = step.flag;
+    if constexpr (flag == pattern_flag::literal) {
+      out.append(text.substr(step.offset, step.length));
+    } else if constexpr (flag == pattern_flag::year) {
+      append_digits<4>(out, static_cast<uint32_t>(time.civil.year));
+    } else if constexpr (flag == pattern_flag::month) {
+      append_digits<2>(out, time.civil.month);
+    } else if constexpr (flag == pattern_flag::day) {
+      append_digits<2>(out, time.civil.day);
+    } else if constexpr (flag == pattern_flag::hour) {
+      append_digits<2>(out, time.civil.hour);
+    } else if constexpr (flag == pattern_flag::minute) {
+      append_digits<2>(out, time.civil.minute);
+    } else if constexpr (flag == pattern_flag::second) {
+      append_digits<2>(out, time.civil.second);
+    } else if constexpr (flag == pattern_flag::date) {
+      char buf[10];
+      time_util::write_digits<4>(buf, static_cast<uint32_t>(time.civil.year));
+      buf[4] = '-';
+      time_util::write_digits<2>(buf + 5, time.civil.month);
+      buf[7] = '-';
+      time_util::write_digits<2>(buf + 8, time.civil.day);
+      out.append(buf, sizeof(buf));
+    } else if constexpr (flag == pattern_flag::clock) {
+      char buf[8];
+      time_util::write_digits<2>(buf, time.civil.hour);
+      buf[2] = ':';
+      time_util::write_digits<2>(buf + 3, time.civil.minute);
+      buf[5] = ':';
+      time_util::write_digits<2>(buf + 6, time.civil.second);
+      out.append(buf, sizeof(buf));
+    } else if constexpr (flag == pattern_flag::utc_offset) {
+      char buf[6];
+      out.append(buf, time_util::write_utc_offset(buf, time.offset));
+    } else if constexpr (flag == pattern_flag::epoch) {
+      char buf[24];
+      auto [ptr, ec] = std::to_chars(buf, buf + sizeof(buf), time.sec);
+      out.append(buf, ptr);
+    } else if constexpr (flag == pattern_flag::millis) {
+      append_digits<3>(out, time.nanos / 1000000);
+    } else if constexpr (flag == pattern_flag::micros) {
+      append_digits<6>(out, time.nanos / 1000);
+    } else if constexpr (flag == pattern_flag::nanos) {
+      append_digits<9>(out, time.nanos);
+    } else if constexpr (flag == pattern_flag::level) {
+      out.append(helper::LevelStr(record.getLevel()));
+    } else if constexpr (flag == pattern_flag::level_short) {
+      out.push_back(helper::LevelStr(record.getLevel())[0]);
+    } else if constexpr (flag == pattern_flag::name) {
+      out.append(record.getLoggerName());
+    } else if constexpr (flag == pattern_flag::thread) {
+      char buf[16];
+      auto [ptr, ec] = std::to_chars(buf, buf + sizeof(buf), record.getThreadId());
+      out.append(buf, ptr);
+    } else if constexpr (flag == pattern_flag::location) {
+      out.append(record.getSite().location);
+    } else if constexpr (flag == pattern_flag::file) {
+      out.append(record.getSite().file);
+    } else if constexpr (flag == pattern_flag::line) {
+      char buf[16];
+      auto [ptr, ec] = std::to_chars(buf, buf + sizeof(buf), record.getSite().line);
+      out.append(buf, ptr);
+    } else if constexpr (flag == pattern_flag::function) {
+      out.append(record.getSite().function);
+    } else if constexpr (flag == pattern_flag::message) {
+      out.append(record.getMessage());
+    } else if constexpr (flag == pattern_flag::fields) {
+      for_each_field(record.getFields(), [&](std::string_view key, const arg_value& value) {
+        out.push_back(' ');
+        out.append(key);
+        out.push_back('=');
+        append_arg(out, value);
+      });
+    } else if constexpr (colored and flag == pattern_flag::color_begin) {
+#ifdef _WIN32
+      // Windows 控制台的颜色是立即生效的状态, 先把之前的部分写出去
+      std::cout << out;
+      out.clear();
+#endif
+      out.append(helper::addColor(record.getLevel()));
+    } else if constexpr (colored and flag == pattern_flag::color_end) {
+#ifdef _WIN32
+      std::cout << out;
+      out.clear();
+#endif
+      out.append(helper::cleanColor(record.getLevel()));
+    }
+  }
+};
+
+/// @brief 运行期可替换的行格式: 同一个编译期 pattern 的文件和控制台两个版本
+struct line_layout {
+  using format_fn = void (*)(std::string&, record_t&);
+
+  format_fn plain   = nullptr;
+  format_fn colored = nullptr;
+};
+
+/// 每个 (pattern, 时区) 一个静态实例, Sink 通过原子指针切换
+template<refvalue::meta_string Pattern, TimeZone Zone = TimeZone::LOCAL>
+constexpr inline line_layout layout_of{&pattern<Pattern, Zone>::template format<false>,
+                                       &pattern<Pattern, Zone>::template format<true>};
+} // namespace detail
+} // namespace xlog
+
+#endif // XLOG_PATTERN_HH
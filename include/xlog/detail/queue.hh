@@ -0,0 +1,310 @@
+//
+// xlog / queue.hh
+// Created by brian on 2024-07-21.
+//
+
+#ifndef XLOG_QUEUE_HH
+#define XLOG_QUEUE_HH
+
+#include "xlog/detail/config.hh"
+#include "xlog/vendor/concurrent_queue.hh"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+namespace xlog {
+namespace detail {
+constexpr inline size_t cache_line_size = 64;
+
+/// @brief 有界的单生产者单消费者环形队列, 读写下标各占一个 cache line
+template<typename T>
+class spsc_ring {
+public:
+  explicit spsc_ring(size_t capacity)
+      : mask_(roundUp(capacity) - 1)
+      , slots_(new T[mask_ + 1]) {}
+
+  /// 生产者调用, 队列满时返回 false
+  bool try_push(T&& item) {
+    size_t const tail = tail_.load(std::memory_order_relaxed);
+    if (tail - cachedHead_ > mask_) {
+      cachedHead_ = head_.load(std::memory_order_acquire);
+      if (tail - cachedHead_ > mask_) return false;
+    }
+    slots_[tail & mask_] = std::move(item);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// 消费者调用, 队列空时返回 nullptr
+  T* front() {
+    size_t const head = head_.load(std::memory_order_relaxed);
+    if (head == cachedTail_) {
+      cachedTail_ = tail_.load(std::memory_order_acquire);
+      if (head == cachedTail_) return nullptr;
+    }
+    return &slots_[head & mask_];
+  }
+
+  /// 消费者调用, 必须在 front() 返回非空之后
+  void pop() { head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+  /// @brief 消费者调用: 按顺序把未消费的记录原地交给 fn, 不出队; fn 返回 false 时停止
+  /// @return 是否遍历完
+  template<typename Fn>
+  bool for_each(Fn&& fn) {
+    size_t const tail = tail_.load(std::memory_order_acquire);
+    for (size_t i = head_.load(std::memory_order_relaxed); i != tail; ++i) {
+      if (not fn(slots_[i & mask_])) return false;
+    }
+    return true;
+  }
+
+  size_t size() const {
+    return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+  }
+
+  size_t capacity() const { return mask_ + 1; }
+
+  /// 所属线程已退出, 消费完剩余记录后可以回收
+  void detach() { detached_.store(true, std::memory_order_release); }
+  bool detached() const { return detached_.load(std::memory_order_acquire); }
+
+private:
+  static size_t roundUp(size_t n) {
+    size_t cap = 2;
+    while (cap < n) cap <<= 1;
+    return cap;
+  }
+
+  size_t const         mask_;
+  std::unique_ptr<T[]> slots_;
+  std::atomic<bool>    detached_{false};
+
+  alignas(cache_line_size) std::atomic<size_t> head_{0};
+  size_t cachedTail_ = 0; // 仅消费者访问
+  alignas(cache_line_size) std::atomic<size_t> tail_{0};
+  size_t cachedHead_ = 0; // 仅生产者访问
+};
+} // namespace detail
+
+/// @brief 异步队列达到容量上限时的处理方式
+enum class OverflowPolicy {
+  /// 生产者等待写线程腾出空间
+  BLOCK,
+  /// 最多等待指定时间, 超时后丢弃该条
+  BLOCK_TIMEOUT,
+  /// 丢弃新来的记录
+  DROP_NEWEST,
+  /// 丢弃队列中最旧的记录(启用 XLOG_ENABLE_SPSC_QUEUE 时退化为 DROP_NEWEST)
+  DROP_OLDEST,
+  /// 丢弃低于阈值等级的记录, 不低于阈值的仍然入队
+  DROP_BELOW_LEVEL,
+};
+
+/// @brief 队列溢出计数
+struct overflow_stats {
+  /// 因队列满而等待过的次数
+  uint64_t blocked = 0;
+  /// BLOCK_TIMEOUT 超时后丢弃的条数
+  uint64_t timedOut = 0;
+  uint64_t droppedNewest = 0;
+  uint64_t droppedOldest = 0;
+  uint64_t droppedBelowLevel = 0;
+
+  uint64_t dropped() const { return timedOut + droppedNewest + droppedOldest + droppedBelowLevel; }
+};
+
+/// @brief 所有生产者共用一个 moodycamel 无锁队列
+template<typename T>
+class shared_queue {
+public:
+  /// 不限容量, 只在内存分配失败时返回 false
+  bool enqueue(T&& item) { return queue_.enqueue(std::move(item)); }
+
+  void close() {}
+
+  bool try_dequeue(T& item) { return queue_.try_dequeue(item); }
+
+  /// @brief 崩溃时由消费者线程调用: 依次取出剩余的记录交给 fn, fn 返回 false 时停止.
+  /// 取出的记录故意不析构(析构会归还内存), 它们持有的内存随进程一起结束
+  template<typename Fn>
+  void crash_drain(Fn&& fn) {
+    alignas(T) static unsigned char storage[sizeof(T)];
+    for (;;) {
+      T* const item = ::new (storage) T(); // 直接覆盖上一条
+      if (not queue_.try_dequeue(*item) or not fn(*item)) return;
+    }
+  }
+
+  template<typename It>
+  size_t try_dequeue_bulk(It first, size_t max) {
+    return queue_.try_dequeue_bulk(first, max);
+  }
+
+  size_t size_approx() const { return queue_.size_approx(); }
+
+private:
+  moodycamel::ConcurrentQueue<T> queue_;
+};
+
+/// @brief 每个生产者线程第一次写入时懒注册一个独立的 SPSC 环形队列,
+/// 消费者轮询全部队列, 每次取出队首时间戳最小的记录, 保证输出顺序与时间顺序一致
+/// @note 只允许一个消费者线程; T 需要提供 getTimePoint()
+template<typename T>
+class thread_ring_queue {
+  using ring_t = detail::spsc_ring<T>;
+
+public:
+  explicit thread_ring_queue(size_t ringCapacity = XLOG_SPSC_RING_SIZE)
+      : ringCapacity_(ringCapacity) {}
+
+  thread_ring_queue(const thread_ring_queue&)            = delete;
+  thread_ring_queue& operator=(const thread_ring_queue&) = delete;
+
+  ~thread_ring_queue() {
+    std::lock_guard guard(regMtx_);
+    for (auto& ring : rings_) ring->detach();
+  }
+
+  /// @brief 当前线程的队列满时让出CPU, 直到消费者腾出空间
+  /// @return 队列满且已 close(不再有消费者)时返回 false, item 保持不变
+  bool enqueue(T&& item) {
+    ring_t& ring = localRing();
+    while (not ring.try_push(std::move(item))) {
+      if (closed_.load(std::memory_order_acquire)) return false;
+      std::this_thread::yield();
+    }
+    return true;
+  }
+
+  /// 消费者已停止, 之后队列满时 enqueue 不再等待
+  void close() { closed_.store(true, std::memory_order_release); }
+
+  bool try_dequeue(T& item) { return try_dequeue_bulk(&item, 1) == 1; }
+
+  /// @brief 崩溃时由消费者线程调用: 逐个队列原地交给 fn, 不出队, 不按时间归并(比较时间戳要换算 TSC),
+  /// 也不刷新快照(要加锁); fn 返回 false 时停止
+  template<typename Fn>
+  void crash_drain(Fn&& fn) {
+    for (auto& ring : snapshot_) {
+      if (not ring->for_each(fn)) return;
+    }
+  }
+
+  /// 按时间戳归并取出最多 max 条记录
+  template<typename It>
+  size_t try_dequeue_bulk(It first, size_t max) {
+    refreshSnapshot();
+    size_t count = 0;
+    for (; count < max; ++count, ++first) {
+      ring_t* oldest = nullptr;
+      T*      head   = nullptr;
+      for (auto& ring : snapshot_) {
+        T* front = ring->front();
+        if (front == nullptr) continue;
+        if (head == nullptr or front->getTimePoint() < head->getTimePoint()) {
+          oldest = ring.get();
+          head   = front;
+        }
+      }
+      if (oldest == nullptr) break;
+      *first = std::move(*head);
+      oldest->pop();
+    }
+    if (count == 0) reclaimDetached();
+    return count;
+  }
+
+  size_t size_approx() const {
+    std::lock_guard guard(regMtx_);
+    size_t          size = 0;
+    for (auto& ring : rings_) size += ring->size();
+    return size;
+  }
+
+private:
+  struct local_entry {
+    uint64_t                owner;
+    std::shared_ptr<ring_t> ring;
+  };
+
+  /// 线程退出时把自己的队列标记为 detached, 由消费者在清空后回收
+  struct local_rings {
+    std::vector<local_entry> entries;
+    ~local_rings() {
+      for (auto& entry : entries) entry.ring->detach();
+    }
+  };
+
+  static uint64_t nextId() {
+    static std::atomic<uint64_t> id{1};
+    return id.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  ring_t& localRing() {
+    thread_local uint64_t lastOwner = 0;
+    thread_local ring_t*  lastRing  = nullptr;
+    if (lastOwner == id_) [[likely]] { return *lastRing; }
+
+    thread_local local_rings locals;
+    for (auto& entry : locals.entries) {
+      if (entry.owner == id_) {
+        lastOwner = id_;
+        lastRing  = entry.ring.get();
+        return *lastRing;
+      }
+    }
+    // 已销毁的队列不会再被消费, 顺便清理掉
+    std::erase_if(locals.entries, [](const local_entry& e) { return e.ring.use_count() == 1; });
+
+    auto ring = std::make_shared<ring_t>(ringCapacity_);
+    {
+      std::lock_guard guard(regMtx_);
+      rings_.push_back(ring);
+      version_.fetch_add(1, std::memory_order_release);
+    }
+    locals.entries.push_back({id_, ring});
+    lastOwner = id_;
+    lastRing  = ring.get();
+    return *lastRing;
+  }
+
+  void refreshSnapshot() {
+    uint64_t const version = version_.load(std::memory_order_acquire);
+    if (version == snapshotVersion_) return;
+    std::lock_guard guard(regMtx_);
+    snapshot_        = rings_;
+    snapshotVersion_ = version_.load(std::memory_order_relaxed);
+  }
+
+  void reclaimDetached() {
+    bool any = false;
+    for (auto& ring : snapshot_) any |= ring->detached();
+    if (not any) return;
+    std::lock_guard guard(regMtx_);
+    std::erase_if(rings_, [](auto& ring) { return ring->detached() and ring->size() == 0; });
+    version_.fetch_add(1, std::memory_order_release);
+  }
+
+  uint64_t const id_ = nextId();
+  size_t const   ringCapacity_;
+  std::atomic<bool> closed_{false};
+
+  mutable std::mutex                   regMtx_;
+  std::vector<std::shared_ptr<ring_t>> rings_;
+  std::atomic<uint64_t>                version_{0};
+
+  /// 消费者私有的队列快照
+  std::vector<std::shared_ptr<ring_t>> snapshot_;
+  uint64_t                             snapshotVersion_ = 0;
+};
+} // namespace xlog
+
+#endif // XLOG_QUEUE_HH
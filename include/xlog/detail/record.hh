@@ -6,6 +6,10 @@
 #ifndef XLOG_RECORD_HH
 #define XLOG_RECORD_HH
 
+#include "xlog/detail/arena.hh"
+#include "xlog/detail/call_site.hh"
+#include "xlog/detail/clock.hh"
+#include "xlog/detail/deferred.hh"
 #include "xlog/detail/level.hh"
 #include "xlog/detail/time_util.hh"
 #include "xlog/vendor/meta_string.hpp"
@@ -39,35 +43,44 @@ struct has_str<T, std::void_t<decltype(std::declval<std::string>().append(
 template<typename T>
 constexpr inline bool has_str_v = has_str<std::remove_cvref_t<T>>::value;
 } // namespace detail
-/// @brief 一条日志记录实体类
+/// @brief 一条日志记录实体类.
+/// 内容写入对象内部的缓冲区, 超出后转到线程私有的 arena; 文件、行号和等级来自调用点的静态描述符,
+/// logger 名字只保存视图, 稳定状态下构造和写入记录都不调用 operator new
 class record_t {
   using time_point_t = std::chrono::system_clock::time_point;
 
 public:
   record_t() = default;
 
-  record_t(time_point_t tm_point, Level level, std::string_view str)
-      : timePoint_(tm_point),
-        level_(level),
+  /// @param site 调用点的描述符, 必须是静态存储
+  record_t(time_point_t tm_point, const detail::call_site* site)
+      : record_t(log_stamp{tm_point.time_since_epoch().count(), false}, site) {}
+
+  /// @param stamp logger 按时钟模式取得的时间戳, TSC 计数推迟到写出时换算
+  record_t(log_stamp stamp, const detail::call_site* site)
+      : stamp_(stamp.value),
+        site_(site),
         tid_(getTid()),
-        fileStr_(str) {
-    content_.reserve(64);
-  }
+        tscStamp_(stamp.tsc) {}
 
   record_t(record_t&&) = default;
 
   record_t& operator=(record_t&&) = default;
 
-  Level getLevel() const { return level_; }
+  Level getLevel() const { return site_->level; }
 
-  const char* getMessage() {
-    content_.push_back('\n');
-    return content_.data();
+  /// @brief 调用点的静态描述符
+  const detail::call_site& getSite() const { return *site_; }
+
+  /// @brief 日志内容(不含换行), 延迟格式化的记录在第一次调用时完成格式化
+  std::string_view getMessage() {
+    if (isDeferred()) { renderDeferred(); }
+    return content_.view();
   }
 
   /// @brief 获取日志输出所在的源代码文件
-  /// @return 短文件路径
-  std::string_view getFileStr() const { return fileStr_; }
+  /// @return "[file:line] ", 内部记录为空
+  std::string_view getFileStr() const { return site_->prefix; }
 
   /// @brief 获取logger名
   /// @return sv
@@ -76,8 +89,21 @@ public:
   /// @brief 获取当前线程 ID
   unsigned int getThreadId() const { return tid_; }
 
+  /// @brief 结构化字段的编码字节, 用 detail::for_each_field 遍历
+  std::string_view getFields() const { return fields_.view(); }
+
   /// @brief 获取时间戳
-  auto getTimePoint() const { return timePoint_; }
+  time_point_t getTimePoint() const { return detail::to_time_point({stamp_, tscStamp_}); }
+
+  /// @brief 未换算的原始时间戳, 崩溃时不经 tsc_clock 自行换算
+  log_stamp getStamp() const { return {stamp_, tscStamp_}; }
+
+  /// @brief 把 TSC 计数换算为墙上时间并保存, 之后的 getTimePoint 不再换算; 由 Sink 在输出前调用
+  void resolveTime() {
+    if (not tscStamp_) return;
+    stamp_    = getTimePoint().time_since_epoch().count();
+    tscStamp_ = false;
+  }
 
   /// @brief 返回一个自身的引用
   record_t& ref() { return *this; }
@@ -87,10 +113,9 @@ public:
   record_t& operator<<(const T& data) {
     using U = std::remove_cvref_t<T>;
     if constexpr (std::is_floating_point_v<U>) {
-      std::array<char, 64> buff{};
-      auto result = std::to_chars(buff.begin(), buff.end(), data);
-      *result.ptr = '\0';
-      content_.append(buff.data());
+      char* buf       = content_.prepare(64);
+      auto [ptr, err] = std::to_chars(buf, buf + 64, data);
+      content_.commit(ptr - buf);
     } else if constexpr (std::is_same_v<bool, U>) {
       data ? content_.append("true") : content_.append("false");
     } else if constexpr (std::is_same_v<char, U>) {
@@ -98,9 +123,9 @@ public:
     } else if constexpr (std::is_enum_v<U>) {
       *this << static_cast<int>(data);
     } else if constexpr (std::is_integral_v<U>) {
-      char buf[32];
+      char* buf       = content_.prepare(32);
       auto [ptr, err] = std::to_chars(buf, buf + 32, data);
-      content_.append(buf, std::distance(buf, ptr));
+      content_.commit(ptr - buf);
     } else if constexpr (std::is_pointer_v<U>) {
       char buf[32]    = {"0x"};
       auto [ptr, err] = std::to_chars(buf + 2, buf + 32, (uintptr_t)data, 16);
@@ -109,23 +134,38 @@ public:
                          std::is_same_v<std::string_view, U>) {
       content_.append(data.data(), data.size());
     } else if constexpr (detail::c_array_v<U>) {
-      content_.append(data);
+      content_.append(std::string_view(data));
     } else if constexpr (detail::has_data_v<U>) {
-      content_.append(data.data());
+      content_.append(std::string_view(data.data()));
     } else if constexpr (detail::has_str_v<U>) {
-      content_.append(data.str());
+      content_.append(std::string_view(data.str()));
     } else if constexpr (std::is_same_v<std::chrono::system_clock::time_point,
                                         U>) {
       content_.append(xlog::time_util::get_local_time_str(data));
     } else {
       std::stringstream ss;
       ss << data;
-      content_.append(std::move(ss).str());
+      content_.append(std::string_view(std::move(ss).str()));
     }
 
     return *this;
   }
 
+  /// @brief 追加一个结构化字段, 例如 XLOG_INFO.kv("user", id).kv("lat_us", t) << "msg".
+  /// 值按类型保存(整数、浮点、布尔、字符串...), 由行格式的 %k 或 JSON 布局在输出时渲染
+  /// @param key 字段名, 和值一起拷贝进记录
+  template<typename T>
+  record_t& kv(std::string_view key, const T& value) {
+    detail::encode_field(fields_, key, value);
+    return *this;
+  }
+
+  /// @brief 采样宏输出的记录带上之前被跳过的次数(字段 suppressed), 为 0 时不添加
+  record_t& suppressed(uint64_t count) {
+    if (count != 0) kv("suppressed", count);
+    return *this;
+  }
+
   template<typename... Args>
   record_t& sprintf(const char* fmt, Args&&... args) {
     printf_string_format(fmt, std::forward<Args>(args)...);
@@ -134,28 +174,56 @@ public:
 
   template<typename String>
   record_t& format(String&& str) {
-    content_.append(str.data());
+    content_.append(std::string_view(str.data()));
     return *this;
   }
 
-  void setLoggerName(const std::string& name) { loggerName_ = name; }
-  void setLoggerId(size_t id) { loggerId_ = id; }
+#if defined(XLOG_HAS_FMT_LIB) or defined(XLOG_HAS_STD_FORMAT)
+  /// @brief 延迟格式化: 调用线程只保存格式串和参数的原始字节,
+  /// 真正的格式化推迟到 getMessage() (异步模式下即后台线程) 中进行
+  /// @note 格式串必须是字面量(编译期检查), record 只保存它的视图
+  template<typename... Args>
+  record_t& defer(detail::format_string_t<Args...> fmt, Args&&... args) {
+    deferredFmt_ = detail::format_string_view<Args...>(fmt);
+    detail::encode_args(content_, args...);
+    return *this;
+  }
+#endif
+
+  /// @brief 是否还有尚未格式化的延迟参数
+  bool isDeferred() const { return deferredFmt_.data() != nullptr; }
+
+  /// @brief 延迟格式化的格式串, 已格式化时为空
+  std::string_view getDeferredFormat() const { return deferredFmt_; }
+
+  /// @brief 不触发格式化的内容: 延迟格式化时是参数的原始字节, 否则即日志内容
+  std::string_view getRawContent() const { return content_.view(); }
+
+  /// @brief 还原线程 ID 和结构化字段, 供离线解码二进制日志时重建记录
+  void restore(uint32_t tid, std::string_view fields) {
+    tid_ = tid;
+    fields_.assign(fields);
+  }
+
+  /// @param name 必须在记录写出前一直有效, logger 传入的是 intern_name 的结果
+  void setLoggerName(std::string_view name) { loggerName_ = name; }
 
 private:
+  void renderDeferred() {
+    // 写线程复用同一个字符串, 容量稳定后不再分配
+    static thread_local std::string text;
+    text.clear();
+    detail::render_deferred(text, deferredFmt_, content_.view());
+    content_.assign(text);
+    deferredFmt_ = {};
+  }
+
   template<typename... Args>
   void printf_string_format(const char* fmt, Args&&... args) {
-    size_t const size{snprintf(nullptr, 0, fmt, std::forward<Args>(args)...)};
-#if defined(XLOG_ENABLE_PMR) and __has_include(<memory_resource> )
-    char                                arr[1024];
-    std::pmr::monotonic_buffer_resource resource(arr, 1024);
-    std::pmr::string                    buf{&resource};
-#else
-    std::string buf;
-#endif
-    buf.reserve(size + 1);
-    buf.resize(size);
-    snprintf(buf.data(), size + 1, fmt, args...);
-    content_.append(buf);
+    int const size = snprintf(nullptr, 0, fmt, args...);
+    if (size <= 0) return;
+    snprintf(content_.prepare(size + 1), size + 1, fmt, args...);
+    content_.commit(size);
   }
 
   ///@brief 返回线程ID
@@ -185,32 +253,24 @@ private:
 #endif
   }
 
-  time_point_t timePoint_;
-  Level        level_;
-  uint32_t     tid_{};
-  size_t       loggerId_{0};
-  std::string  loggerName_{logger_default_name};
-  std::string  fileStr_;
-#if defined(XLOG_ENABLE_PMR) and __has_include(<memory_resource> )
-  char                                arr_[1024];
-  std::pmr::monotonic_buffer_resource resource_;
-  std::pmr::string                    ss_{&resource_};
-#else
-  std::string content_;
-#endif
+  /// system_clock 的 tick 数, tscStamp_ 为 true 时是 TSC 计数
+  int64_t                  stamp_ = 0;
+  const detail::call_site* site_  = &detail::internal_site<Level::TRACE>;
+  uint32_t                 tid_{};
+  bool                     tscStamp_ = false;
+  /// 指向 intern_name 的字符串池
+  std::string_view loggerName_{logger_default_name};
+  /// 不为空指针时 content_ 中保存的是待格式化参数的原始字节
+  std::string_view      deferredFmt_;
+  detail::record_buffer content_;
+  detail::field_buffer  fields_;
 };
 
 #define TO_STR(s) #s
 
-/// 一个lambda函数的执行结果
+/// 指向静态存储的 "[file:line] ", 日志宏改用 XLOG_DECLARE_SITE 后保留给外部代码
 #define GET_STRING(filename, line)                                             \
-  [] {                                                                         \
-    constexpr auto   path = refvalue::meta_string{filename};                   \
-    constexpr size_t pos =                                                     \
-        path.rfind(std::filesystem::path::preferred_separator);                \
-    constexpr auto name   = path.substr<pos + 1>();                            \
-    constexpr auto prefix = name + ":" + TO_STR(line);          \
-    return "[" + prefix + "] ";                                 \
-  }()
+  std::string_view(xlog::detail::site_strings<refvalue::meta_string{filename}, \
+                                              refvalue::meta_string{XLOG_STRINGIFY(line)}>::prefix)
 }
 #endif // XLOG_RECORD_HH
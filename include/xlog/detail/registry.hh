@@ -0,0 +1,160 @@
+//
+// xlog / registry.hh
+// Created by brian on 2024-08-02.
+//
+
+#ifndef XLOG_REGISTRY_HH
+#define XLOG_REGISTRY_HH
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace xlog {
+class ILogger;
+
+/// @brief 注册表中 logger 的整数句柄, 在进程内一直有效
+enum class logger_handle : uint32_t {};
+
+constexpr inline logger_handle invalid_logger_handle = logger_handle(UINT32_MAX);
+
+/// @brief 全局 logger 注册表, 按 hashed(name) 登记编译期和运行期创建的 logger.
+///
+/// 读操作既不加锁也不等待:
+/// - 句柄到 logger 的映射是分块数组, 块一旦分配就不再移动, 查找只需两次指针读取;
+/// - 名字(hash)到句柄的映射是只增不删的开放寻址表, 扩容时写方在锁内拷贝出新表再原子发布,
+///   旧表留到注册表析构时释放, 读方最多探测一遍当前表.
+/// 写操作(新建 logger)由互斥锁串行化.
+class logger_registry {
+  static constexpr size_t chunk_bits = 10;
+  static constexpr size_t chunk_size = size_t(1) << chunk_bits;
+  static constexpr size_t max_chunks = 4096;
+
+  struct entry {
+    size_t   key   = 0;
+    uint32_t index = 0;
+  };
+
+  struct table {
+    explicit table(size_t capacity)
+        : mask(capacity - 1)
+        , slots(new std::atomic<const entry*>[capacity]) {
+      for (size_t i = 0; i < capacity; ++i) slots[i].store(nullptr, std::memory_order_relaxed);
+    }
+
+    size_t const                                 mask;
+    std::unique_ptr<std::atomic<const entry*>[]> slots;
+  };
+
+public:
+  constexpr logger_registry() = default;
+
+  logger_registry(const logger_registry&)            = delete;
+  logger_registry& operator=(const logger_registry&) = delete;
+
+  ~logger_registry() {
+    for (auto& chunk : chunks_) delete[] chunk.load(std::memory_order_relaxed);
+  }
+
+  /// @brief 按 key 查找句柄, 无锁无等待
+  /// @return 不存在时返回 invalid_logger_handle
+  logger_handle find(size_t key) const {
+    const table* t = table_.load(std::memory_order_acquire);
+    if (t == nullptr) return invalid_logger_handle;
+    for (size_t i = mix(key) & t->mask, n = 0; n <= t->mask; i = (i + 1) & t->mask, ++n) {
+      const entry* e = t->slots[i].load(std::memory_order_acquire);
+      if (e == nullptr) break;
+      if (e->key == key) return logger_handle(e->index);
+    }
+    return invalid_logger_handle;
+  }
+
+  /// @brief 句柄对应的 logger, 无锁无等待
+  /// @return 句柄无效(find 没有找到或 add 时注册表已满)时返回 nullptr
+  ILogger* get(logger_handle handle) const {
+    auto const index = static_cast<uint32_t>(handle);
+    if ((index >> chunk_bits) >= max_chunks) return nullptr;
+    ILogger** chunk = chunks_[index >> chunk_bits].load(std::memory_order_acquire);
+    return chunk == nullptr ? nullptr : chunk[index & (chunk_size - 1)];
+  }
+
+  /// @brief 持有 logger 所有权的智能指针, 用于兼容返回 shared_ptr 的接口
+  /// @return 句柄无效或越界时返回 nullptr
+  std::shared_ptr<ILogger> owner(logger_handle handle) const {
+    auto const      index = static_cast<uint32_t>(handle);
+    std::lock_guard guard(mtx_);
+    return index < owners_.size() ? owners_[index] : nullptr;
+  }
+
+  /// @brief 登记 key 对应的 logger, 已存在时直接返回已有的句柄
+  /// @param make 只在 key 不存在时调用, 返回新 logger 的 shared_ptr
+  template<typename Factory>
+  logger_handle add(size_t key, Factory&& make) {
+    if (logger_handle h = find(key); h != invalid_logger_handle) return h;
+    std::lock_guard guard(mtx_);
+    if (logger_handle h = find(key); h != invalid_logger_handle) return h;
+
+    auto const index = static_cast<uint32_t>(owners_.size());
+    if ((index >> chunk_bits) >= max_chunks) return invalid_logger_handle;
+    ILogger** chunk = chunks_[index >> chunk_bits].load(std::memory_order_relaxed);
+    if (chunk == nullptr) {
+      chunk = new ILogger*[chunk_size]{};
+      chunks_[index >> chunk_bits].store(chunk, std::memory_order_release);
+    }
+    owners_.push_back(make());
+    chunk[index & (chunk_size - 1)] = owners_.back().get();
+
+    entries_.push_back(std::make_unique<entry>(entry{key, index}));
+    const table* t = table_.load(std::memory_order_relaxed);
+    // 负载超过一半时扩容, 保证读方的探测很短
+    if (t == nullptr or (entries_.size() * 2 > t->mask + 1)) {
+      auto bigger = std::make_unique<table>(t == nullptr ? 64 : (t->mask + 1) * 2);
+      for (auto& e : entries_) insert(*bigger, e.get());
+      t = bigger.get();
+      tables_.push_back(std::move(bigger));
+      table_.store(t, std::memory_order_release);
+    } else {
+      insert(*t, entries_.back().get());
+    }
+    return logger_handle(index);
+  }
+
+  /// 已登记的 logger 个数
+  size_t size() const {
+    std::lock_guard guard(mtx_);
+    return owners_.size();
+  }
+
+private:
+  static size_t mix(size_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key;
+  }
+
+  static void insert(const table& t, const entry* e) {
+    size_t i = mix(e->key) & t.mask;
+    while (t.slots[i].load(std::memory_order_relaxed) != nullptr) i = (i + 1) & t.mask;
+    t.slots[i].store(e, std::memory_order_release);
+  }
+
+  std::atomic<const table*> table_{nullptr};
+  std::atomic<ILogger**>    chunks_[max_chunks]{};
+
+  mutable std::mutex                    mtx_;
+  std::vector<std::shared_ptr<ILogger>> owners_;
+  std::vector<std::unique_ptr<entry>>   entries_;
+  std::vector<std::unique_ptr<table>>   tables_;
+};
+
+/// @brief 全局注册表, 常量初始化, 访问时没有静态变量的初始化检查
+inline constinit logger_registry global_registry;
+
+inline logger_registry& registry() { return global_registry; }
+} // namespace xlog
+
+#endif // XLOG_REGISTRY_HH
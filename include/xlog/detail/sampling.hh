@@ -0,0 +1,113 @@
+//
+// xlog / sampling.hh
+// Created by brian on 2024-08-11.
+//
+
+#ifndef XLOG_SAMPLING_HH
+#define XLOG_SAMPLING_HH
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace xlog::detail {
+/// 采样状态使用的单调时钟, 纳秒
+inline int64_t sampling_now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// 下面是每个调用点的采样状态, 由 XLOG_EVERY_N 等宏声明为静态变量, 全部无锁.
+// admit 在日志等级检查之后、构造记录之前调用, 返回 false 时整条语句(包括参数求值)被跳过,
+// 返回 true 时 suppressed 为上一条输出之后被跳过的次数
+
+/// @brief 第 1, n+1, 2n+1 ... 次输出
+class every_n_sampler {
+public:
+  bool admit(uint64_t n, uint64_t& suppressed) {
+    uint64_t const count = count_.fetch_add(1, std::memory_order_relaxed);
+    if (n > 1 and count % n != 0) return false;
+    suppressed = count == 0 or n <= 1 ? 0 : n - 1;
+    return true;
+  }
+
+private:
+  std::atomic<uint64_t> count_{0};
+};
+
+/// @brief 只输出前 n 次
+class first_n_sampler {
+public:
+  bool admit(uint64_t n, uint64_t& suppressed) {
+    // 超过 n 之后不再写入, 避免热点上的缓存行争用
+    if (count_.load(std::memory_order_relaxed) >= n) return false;
+    suppressed = 0;
+    return count_.fetch_add(1, std::memory_order_relaxed) < n;
+  }
+
+private:
+  std::atomic<uint64_t> count_{0};
+};
+
+/// @brief 每个时间间隔最多输出一次
+class every_t_sampler {
+public:
+  template<typename Rep, typename Period>
+  bool admit(std::chrono::duration<Rep, Period> interval, uint64_t& suppressed) {
+    return admit(interval, suppressed, sampling_now());
+  }
+
+  /// @param now sampling_now() 的读数, 测试时可以传入模拟的时间
+  template<typename Rep, typename Period>
+  bool admit(std::chrono::duration<Rep, Period> interval, uint64_t& suppressed, int64_t now) {
+    int64_t next = next_.load(std::memory_order_relaxed);
+    if (now < next or not next_.compare_exchange_strong(
+                          next, now + std::chrono::duration_cast<std::chrono::nanoseconds>(interval).count(),
+                          std::memory_order_relaxed)) {
+      suppressed_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+    return true;
+  }
+
+private:
+  std::atomic<int64_t>  next_{INT64_MIN};
+  std::atomic<uint64_t> suppressed_{0};
+};
+
+/// @brief 令牌桶限速: 平均每秒 perSecond 条, 最多积攒一秒的令牌(不足一个时为一个, 如每秒 0.5 条即两秒一条).
+/// 用 GCRA 实现, 桶的状态是一个时间点(令牌恰好耗尽的时刻), 一次 CAS 完成取令牌
+class rate_limiter {
+public:
+  bool admit(double perSecond, uint64_t& suppressed) { return admit(perSecond, suppressed, sampling_now()); }
+
+  /// @param now sampling_now() 的读数, 测试时可以传入模拟的时间
+  bool admit(double perSecond, uint64_t& suppressed, int64_t now) {
+    if (perSecond <= 0) {
+      suppressed_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    auto const    cost  = static_cast<int64_t>(1e9 / perSecond);
+    int64_t const burst = (std::max)(1'000'000'000 - cost, int64_t(0)); // 桶满时允许的提前量
+    int64_t       tat   = tat_.load(std::memory_order_relaxed);
+    while (true) {
+      int64_t const base = tat > now ? tat : now;
+      if (base - now > burst) {
+        suppressed_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      if (tat_.compare_exchange_weak(tat, base + cost, std::memory_order_relaxed)) break;
+    }
+    suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+    return true;
+  }
+
+private:
+  std::atomic<int64_t>  tat_{INT64_MIN};
+  std::atomic<uint64_t> suppressed_{0};
+};
+} // namespace xlog::detail
+
+#endif // XLOG_SAMPLING_HH
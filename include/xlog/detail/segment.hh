@@ -0,0 +1,396 @@
+//
+// xlog / segment.hh
+// Created by brian on 2024-07-28.
+//
+
+#ifndef XLOG_SEGMENT_HH
+#define XLOG_SEGMENT_HH
+
+#include "xlog/detail/compressor.hh"
+
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <ctime>
+#include <condition_variable>
+#include <cstdint>
+#include <algorithm>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+  #include <fcntl.h>
+  #include <io.h>
+  #include <sys/stat.h>
+#else
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
+namespace xlog {
+/// @brief 日志文件滚动方式
+enum class RollMode {
+  /// xlog.txt 为当前文件, 滚动时依次重命名为 xlog.1.txt, xlog.2.txt ...
+  RENAME,
+  /// 文件按 xlog.N.txt 单调编号, 滚动时只需打开新段并删除最旧的一个
+  SEQUENCE,
+};
+
+/// @brief 按时间切分日志文件的周期
+enum class RollInterval {
+  NONE,
+  /// 每小时一个文件: stem.YYYYMMDD-HH.ext
+  HOURLY,
+  /// 每天一个文件: stem.YYYYMMDD.ext
+  DAILY,
+};
+
+/// @brief 在文件名的扩展名前插入标签: stem.tag.ext
+inline std::string segment_name(const std::string& filename, std::string_view tag) {
+  auto        path = std::filesystem::path(filename);
+  std::string name = path.stem().string();
+  name.append(".").append(tag).append(path.extension().string());
+  return path.has_parent_path() ? (path.parent_path() / name).string() : name;
+}
+
+/// @brief 第 seq 个日志段的文件名: stem.seq.ext
+inline std::string segment_name(const std::string& filename, uint64_t seq) {
+  char buf[24];
+  auto [ptr, ec] = std::to_chars(buf, buf + sizeof(buf), seq);
+  return segment_name(filename, std::string_view(buf, ptr - buf));
+}
+
+/// @brief 时间点所在的周期
+struct roll_period {
+  /// 周期的文件名标签, 如 20240728 或 20240728-13
+  std::string label;
+  /// 下一个周期开始的时刻, 单位为 system_clock 的 tick
+  int64_t nextBoundary = 0;
+};
+
+/// @brief 计算 tp 所在的本地时间周期, 只在跨越边界时调用一次
+inline roll_period period_of(RollInterval interval, std::chrono::system_clock::time_point tp) {
+  std::time_t const t = std::chrono::system_clock::to_time_t(tp);
+  std::tm           tm{};
+#ifdef _WIN32
+  ::localtime_s(&tm, &t);
+#else
+  ::localtime_r(&t, &tm);
+#endif
+  char buf[16];
+  if (interval == RollInterval::HOURLY) {
+    std::strftime(buf, sizeof(buf), "%Y%m%d-%H", &tm);
+    tm.tm_hour += 1;
+  } else {
+    std::strftime(buf, sizeof(buf), "%Y%m%d", &tm);
+    tm.tm_mday += 1;
+    tm.tm_hour = 0;
+  }
+  tm.tm_min   = 0;
+  tm.tm_sec   = 0;
+  tm.tm_isdst = -1; // 交给 mktime 处理夏令时切换
+  auto next   = std::chrono::system_clock::from_time_t(std::mktime(&tm));
+  return {buf, static_cast<int64_t>(next.time_since_epoch().count())};
+}
+
+/// 后台压缩后日志段可能带有的后缀
+constexpr inline std::string_view compressed_suffixes[] = {".gz", ".zst"};
+
+/// 日志段旁边的时间索引文件的后缀, 见 time_index.hh
+constexpr inline std::string_view index_suffix = ".idx";
+
+/// @brief 删除一个日志段, 包括它压缩后的文件和时间索引
+inline void remove_segment(const std::string& path) {
+  std::error_code ec;
+  std::filesystem::remove(path, ec);
+  std::filesystem::remove(std::string(path).append(index_suffix), ec);
+  for (auto suffix : compressed_suffixes) {
+    std::filesystem::remove(std::string(path).append(suffix), ec);
+  }
+}
+
+/// @brief 解析 stem.N.ext 形式的文件名, 已压缩的 stem.N.ext.gz 和索引 stem.N.ext.idx 同样算作第 N 段
+/// @return 不是该日志的段文件时返回 0
+inline uint64_t parse_segment_seq(const std::string& filename, std::string_view candidate) {
+  if (candidate.ends_with(index_suffix)) candidate.remove_suffix(index_suffix.size());
+  for (auto suffix : compressed_suffixes) {
+    if (candidate.ends_with(suffix)) {
+      candidate.remove_suffix(suffix.size());
+      break;
+    }
+  }
+  auto        path   = std::filesystem::path(filename);
+  std::string prefix = path.stem().string() + ".";
+  std::string suffix = path.extension().string();
+  if (candidate.size() <= prefix.size() + suffix.size() or not candidate.starts_with(prefix) or
+      not candidate.ends_with(suffix)) {
+    return 0;
+  }
+  auto     num = candidate.substr(prefix.size(), candidate.size() - prefix.size() - suffix.size());
+  uint64_t seq = 0;
+  auto [ptr, err] = std::from_chars(num.data(), num.data() + num.size(), seq);
+  return err == std::errc{} and ptr == num.data() + num.size() ? seq : 0;
+}
+
+/// @brief 遍历 filename 所在目录中属于该日志的全部段
+template<typename Fn>
+inline void for_each_segment(const std::string& filename, Fn&& fn) {
+  auto            path = std::filesystem::path(filename);
+  auto            dir  = path.has_parent_path() ? path.parent_path() : std::filesystem::path(".");
+  std::error_code ec;
+  for (auto it = std::filesystem::directory_iterator(dir, ec);
+       not ec and it != std::filesystem::directory_iterator(); it.increment(ec)) {
+    std::string name = it->path().filename().string();
+    if (uint64_t seq = parse_segment_seq(filename, name)) fn(seq, it->path());
+  }
+}
+
+/// @brief 已存在的最大段编号, 没有时返回 0
+inline uint64_t last_segment_seq(const std::string& filename) {
+  uint64_t last = 0;
+  for_each_segment(filename, [&](uint64_t seq, const auto&) { last = (std::max)(last, seq); });
+  return last;
+}
+
+/// @brief 按时间切分出的一个日志文件: stem.label.ext 或周期内滚动出的 stem.label.N.ext
+struct period_file {
+  std::string label;
+  uint64_t    seq = 0;
+  /// 去掉压缩后缀的路径, 即 remove_segment 的参数
+  std::string path;
+};
+
+/// @brief 解析按时间切分的文件名, 标签为 YYYYMMDD 或 YYYYMMDD-HH; 压缩后的文件同样算在内, 索引文件不算
+inline bool parse_period_file(const std::string& filename, std::string_view candidate, period_file& file) {
+  if (candidate.ends_with(index_suffix)) return false;
+  for (auto suffix : compressed_suffixes) {
+    if (candidate.ends_with(suffix)) {
+      candidate.remove_suffix(suffix.size());
+      break;
+    }
+  }
+  auto        path   = std::filesystem::path(filename);
+  std::string prefix = path.stem().string() + ".";
+  std::string suffix = path.extension().string();
+  if (candidate.size() <= prefix.size() + suffix.size() or not candidate.starts_with(prefix) or
+      not candidate.ends_with(suffix)) {
+    return false;
+  }
+  auto middle = candidate.substr(prefix.size(), candidate.size() - prefix.size() - suffix.size());
+  auto label  = middle.substr(0, middle.find('.'));
+  auto digits = [](std::string_view str) {
+    return std::all_of(str.begin(), str.end(), [](char c) { return c >= '0' and c <= '9'; });
+  };
+  if (not(label.size() == 8 or (label.size() == 11 and label[8] == '-')) or not digits(label.substr(0, 8)) or
+      not digits(label.substr(label.size() == 11 ? 9 : 8))) {
+    return false;
+  }
+  file.seq = 0;
+  if (label.size() < middle.size()) {
+    auto num        = middle.substr(label.size() + 1);
+    auto [ptr, err] = std::from_chars(num.data(), num.data() + num.size(), file.seq);
+    if (err != std::errc{} or ptr != num.data() + num.size()) return false;
+  }
+  file.label = label;
+  file.path  = (path.has_parent_path() ? path.parent_path() / candidate : std::filesystem::path(candidate)).string();
+  return true;
+}
+
+/// @brief 跨周期的保留: 只留下 filename 按时间切分出的最新 keep 个文件, 当前周期 current 的文件不删除.
+/// 周期内 RENAME 方式编号越大越旧, SEQUENCE 方式编号越大越新
+inline void prune_period_files(const std::string& filename, std::string_view current, size_t keep, RollMode mode) {
+  auto                     path = std::filesystem::path(filename);
+  auto                     dir  = path.has_parent_path() ? path.parent_path() : std::filesystem::path(".");
+  std::vector<period_file> files;
+  std::error_code          ec;
+  for (auto it = std::filesystem::directory_iterator(dir, ec);
+       not ec and it != std::filesystem::directory_iterator(); it.increment(ec)) {
+    period_file file;
+    if (parse_period_file(filename, it->path().filename().string(), file)) files.push_back(std::move(file));
+  }
+  std::sort(files.begin(), files.end(), [mode](const period_file& a, const period_file& b) {
+    if (a.label != b.label) return a.label > b.label;
+    return mode == RollMode::SEQUENCE ? a.seq > b.seq : a.seq < b.seq;
+  });
+  // 压缩过程中原文件和压缩后的文件可能同时存在, 只算一个
+  files.erase(std::unique(files.begin(), files.end(),
+                          [](const period_file& a, const period_file& b) { return a.path == b.path; }),
+              files.end());
+  for (size_t i = keep; i < files.size(); ++i) {
+    if (files[i].label != current) remove_segment(files[i].path);
+  }
+}
+
+/// @brief 在后台线程上完成滚动涉及的文件系统元数据操作:
+/// 提前打开下一个段, 关闭旧段以及删除过期的段, 写入方从不等待这些操作
+class segment_preparer {
+  struct closing_entry {
+    int         fd = -1;
+    std::string path; // 为空时关闭后不压缩
+  };
+
+public:
+  segment_preparer(std::string filename, int openFlags)
+      : filename_(std::move(filename))
+      , openFlags_(openFlags) {
+    worker_ = std::thread([this] { run(); });
+  }
+
+  segment_preparer(const segment_preparer&)            = delete;
+  segment_preparer& operator=(const segment_preparer&) = delete;
+
+  ~segment_preparer() {
+    {
+      std::lock_guard guard(mtx_);
+      stopped_ = true;
+    }
+    cnd_.notify_all();
+    worker_.join();
+    if (preparedFd_ >= 0) {
+      closeFd(preparedFd_);
+      // 从未写入过的预备段直接删掉
+      std::error_code ec;
+      if (std::filesystem::file_size(segment_name(filename_, preparedSeq_), ec) == 0) {
+        std::filesystem::remove(segment_name(filename_, preparedSeq_), ec);
+      }
+    }
+  }
+
+  /// @brief 请求提前打开第 seq 个段; 已请求过时只有一次原子读
+  void prepare(uint64_t seq) {
+    if (requestedSeq_.load(std::memory_order_relaxed) >= seq) return;
+    {
+      std::lock_guard guard(mtx_);
+      if (requestedSeq_.load(std::memory_order_relaxed) >= seq) return;
+      requestedSeq_.store(seq, std::memory_order_relaxed);
+    }
+    cnd_.notify_all();
+  }
+
+  /// @brief 取走提前打开的第 seq 个段
+  /// @return 还没有准备好时返回 -1, 调用方需自行同步打开
+  int take(uint64_t seq) {
+    std::lock_guard guard(mtx_);
+    if (preparedFd_ < 0 or preparedSeq_ != seq) return -1;
+    int fd      = preparedFd_;
+    preparedFd_ = -1;
+    return fd;
+  }
+
+  /// @brief 在后台关闭旧段 path 的 fd(之后交给压缩线程), 并删除编号为 expiredSeq 的段(0 表示不删除)
+  void retire(int fd, std::string path, uint64_t expiredSeq) {
+    {
+      std::lock_guard guard(mtx_);
+      if (fd >= 0) closing_.push_back({fd, std::move(path)});
+      if (expiredSeq > 0) expired_.push_back(expiredSeq);
+    }
+    cnd_.notify_all();
+  }
+
+  /// @brief 设置关闭后的段交给哪个压缩线程, nullptr 表示不压缩
+  void setCompressor(segment_compressor* compressor) {
+    std::lock_guard guard(mtx_);
+    compressor_ = compressor;
+  }
+
+  /// @brief 在后台删除所有编号 <= seq 的段, 用于启动时清理超出保留数量的旧文件
+  void purgeUpTo(uint64_t seq) {
+    {
+      std::lock_guard guard(mtx_);
+      purgeUpTo_ = (std::max)(purgeUpTo_, seq);
+    }
+    cnd_.notify_all();
+  }
+
+private:
+  void run() {
+    std::unique_lock lock(mtx_);
+    for (;;) {
+      cnd_.wait(lock, [this] { return stopped_ or hasWork(); });
+      if (stopped_ and not hasWork()) break;
+
+      uint64_t const want = requestedSeq_.load(std::memory_order_relaxed);
+      if (want > preparedSeq_) {
+        lock.unlock();
+        int fd = openFd(segment_name(filename_, want));
+        lock.lock();
+        if (preparedFd_ >= 0) closing_.push_back({preparedFd_, {}});
+        preparedFd_  = fd;
+        preparedSeq_ = want;
+        continue;
+      }
+      if (not closing_.empty()) {
+        closing_entry entry = std::move(closing_.front());
+        closing_.pop_front();
+        lock.unlock();
+        closeFd(entry.fd);
+        lock.lock();
+        if (compressor_) compressor_->enqueue(std::move(entry.path));
+        continue;
+      }
+      if (not expired_.empty()) {
+        uint64_t seq = expired_.front();
+        expired_.pop_front();
+        lock.unlock();
+        remove_segment(segment_name(filename_, seq));
+        lock.lock();
+        continue;
+      }
+      if (purgeUpTo_ > 0) {
+        uint64_t const upTo = purgeUpTo_;
+        purgeUpTo_          = 0;
+        lock.unlock();
+        for_each_segment(filename_, [&](uint64_t seq, const auto& path) {
+          std::error_code ec;
+          if (seq <= upTo) std::filesystem::remove(path, ec); // 压缩文件也会被遍历到
+        });
+        lock.lock();
+      }
+    }
+  }
+
+  bool hasWork() const {
+    uint64_t const want = requestedSeq_.load(std::memory_order_relaxed);
+    return want > preparedSeq_ or not closing_.empty() or not expired_.empty() or purgeUpTo_ > 0;
+  }
+
+  int openFd(const std::string& path) const {
+#ifdef _WIN32
+    return ::_open(path.c_str(), openFlags_ | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    return ::open(path.c_str(), openFlags_, 0644);
+#endif
+  }
+
+  static void closeFd(int fd) {
+#ifdef _WIN32
+    ::_close(fd);
+#else
+    ::close(fd);
+#endif
+  }
+
+  std::string const filename_;
+  int const         openFlags_;
+
+  std::mutex              mtx_;
+  std::condition_variable cnd_;
+  std::atomic<uint64_t>   requestedSeq_{0};
+  uint64_t                preparedSeq_ = 0;
+  int                     preparedFd_  = -1;
+  std::deque<closing_entry> closing_;
+  segment_compressor*     compressor_ = nullptr;
+  std::deque<uint64_t>    expired_;
+  uint64_t                purgeUpTo_ = 0;
+  bool                    stopped_   = false;
+  std::thread             worker_;
+};
+} // namespace xlog
+
+#endif // XLOG_SEGMENT_HH
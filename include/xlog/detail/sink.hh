@@ -6,170 +6,25 @@
 #ifndef XLOG_SINK_HH
 #define XLOG_SINK_HH
 
+#include "xlog/detail/binlog.hh"
+#include "xlog/detail/crash.hh"
+#include "xlog/detail/file_writer.hh"
+#include "xlog/detail/mmap_writer.hh"
+#include "xlog/detail/pattern.hh"
+#include "xlog/detail/queue.hh"
 #include "xlog/detail/record.hh"
-#include "xlog/vendor/concurrent_queue.hh"
+#include "xlog/detail/segment.hh"
+#include "xlog/detail/time_index.hh"
 
 #include <charconv>
 #include <condition_variable>
 #include <filesystem>
-#include <fstream>
 #include <iostream>
-#include <shared_mutex>
 #include <string>
 #include <string_view>
 #include <system_error>
 
 namespace xlog {
-namespace helper {
-constexpr char digits[10] = {
-  '0', '1', '2', '3', '4', '5', '6', '7', '8', '9'
-};
-
-template <size_t N, char c>
-inline void toInt(int num, char* p, int& size) {
-  for (int i = 0; i < N; i++) {
-    p[--size] = digits[num % 10];
-    num       = num / 10;
-  }
-  if constexpr (N != 4) p[--size] = c;
-}
-
-inline char* getTimeStr(const auto& now) {
-  static thread_local char                 buf[24];
-  static thread_local std::chrono::seconds last_sec_{};
-
-  std::chrono::system_clock::duration d{ now.time_since_epoch() };
-
-  std::chrono::seconds s{ std::chrono::duration_cast<std::chrono::seconds>(d) };
-
-  long mill_sec =
-    std::chrono::duration_cast<std::chrono::milliseconds>(d - s).count();
-  int size = 23;
-  if (last_sec_ == s) {
-    toInt<3, '.'>(static_cast<int>(mill_sec), buf, size);
-    return buf;
-  }
-
-  last_sec_ = s;
-  auto tm   = std::chrono::system_clock::to_time_t(now);
-  auto gmt  = localtime(&tm);
-
-  toInt<3, '.'>(static_cast<int>(mill_sec), buf, size);
-  toInt<2, ':'>(gmt->tm_sec, buf, size);
-  toInt<2, ':'>(gmt->tm_min, buf, size);
-  toInt<2, ' '>(gmt->tm_hour, buf, size);
-
-  toInt<2, '-'>(gmt->tm_mday, buf, size);
-  toInt<2, '-'>(gmt->tm_mon + 1, buf, size);
-  toInt<4, ' '>(gmt->tm_year + 1900, buf, size);
-  return buf;
-}
-
-/// @brief 日志等级对应的字符串
-/// @param level 等级 enum
-/// @return 长度为 6 的字符串
-inline std::string_view LevelStr(Level level) {
-  switch (level) {
-  //@format:off
-  case Level::TRACE:
-    return "TRACE ";
-  case Level::DEBUG:
-    return "DEBUG ";
-  case Level::INFO:
-    return "INFO  ";
-  case Level::WARN:
-    return "WARN  ";
-  case Level::ERROR:
-    return "ERROR ";
-  case Level::FATAL:
-    return "FATAL ";
-  default:
-    return "NONE  ";
-    // @format:on
-  }
-}
-
-#ifdef _WIN32
-enum class color_type : int {
-  none  = -1,
-  black = 0,
-  blue,
-  green,
-  cyan,
-  red,
-  magenta,
-  yellow,
-  white,
-  black_bright,
-  blue_bright,
-  green_bright,
-  cyan_bright,
-  red_bright,
-  magenta_bright,
-  yellow_bright,
-  white_bright
-};
-
-void windows_set_color(color_type fg, color_type bg) {
-  auto handle = GetStdHandle(STD_OUTPUT_HANDLE);
-  if (handle != nullptr) {
-    CONSOLE_SCREEN_BUFFER_INFO info{};
-    auto status = GetConsoleScreenBufferInfo(handle, &info);
-    if (status) {
-      WORD color = info.wAttributes;
-      if (fg != color_type::none) { color = (color & 0xFFF0) | int(fg); }
-      if (bg != color_type::none) { color = (color & 0xFF0F) | int(bg) << 4; }
-      SetConsoleTextAttribute(handle, color);
-    }
-  }
-}
-#endif
-
-inline std::string_view addColor(Level level) {
-#if defined(_WIN32)
-  if (level == Level::WARN)
-    windows_set_color(color_type::black, color_type::yellow);
-  if (level == Level::ERROR)
-    windows_set_color(color_type::black, color_type::red);
-  if (level == Level::FATAL)
-    windows_set_color(color_type::white_bright, color_type::red);
-#elif __APPLE__
-#else
-  if (level == Level::WARN) return "\x1B[93;1m";
-  if (level == Level::ERROR) return "\x1B[91;1m";
-  if (level == Level::FATAL) return "\x1B[97;1m\x1B[41m";
-#endif
-  return {};
-}
-
-inline std::string_view cleanColor(Level level) {
-#if defined(_WIN32)
-  if (level >= Level::WARN)
-    windows_set_color(color_type::white, color_type::black);
-#elif __APPLE__
-#else
-  if (level >= Level::WARN) return "\x1B[0m\x1B[0K";
-#endif
-  return {};
-}
-
-inline std::string_view getTidBuf(unsigned int tid) {
-  thread_local char         buf[24];
-  thread_local unsigned int last_tid;
-  thread_local size_t       last_len;
-  if (tid == last_tid) { return { buf, last_len }; }
-
-  buf[0]          = '[';
-  auto [ptr, ec]  = std::to_chars(buf + 1, buf + 21, tid);
-  buf[22]         = ']';
-  buf[23]         = ' ';
-  last_tid        = tid;
-  last_len        = ptr - buf;
-  buf[last_len++] = ']';
-  buf[last_len++] = ' ';
-  return { buf, last_len };
-}
-} // namespace helper
 struct empty_mutex {
   void lock() {}
 
@@ -179,7 +34,7 @@ struct empty_mutex {
 constexpr inline std::string_view BOM_STR = "\xEF\xBB\xBF";
 
 /// @brief 日志消息消费者，默认支持file和console
-class Sink {
+class Sink final : public detail::crash_target {
 public:
   using ptr  = Sink*;
   using sptr = std::shared_ptr<Sink>;
@@ -187,35 +42,112 @@ public:
     stop();
     startThread();
     enableConsole(true);
+    detail::add_crash_target(this);
   }
 
   Sink(const std::string& filename, bool async, bool enableConsole,
-       int fileMaxSize, int maxFileCount, bool realTimeFlush)
+       int fileMaxSize, int maxFileCount, bool realTimeFlush,
+       size_t bufferSize = XLOG_FILE_BUFFER_SIZE)
       : hasInit_(true)
       , enableConsole_(enableConsole)
       , realTimeFlush_(realTimeFlush)
-      , fileMaxSize_(fileMaxSize) {
+      , fileMaxSize_(fileMaxSize)
+      , file_(bufferSize) {
     filename_     = filename;
+    baseName_     = filename;
     maxFileCount_ = (std::min)(maxFileCount, 100);
-    openLogFile();
+    if (not filename_.empty()) openLogFile(); // 空文件名只输出到控制台
     if (async) startThread();
+    detail::add_crash_target(this);
+  }
+
+#ifndef _WIN32
+  /// @brief 内存映射追加模式: 生产者直接把格式化好的行写进预分配的映射段,
+  /// 不经过写线程也不加锁, 文件按 stem.N.ext 编号, 最多保留 maxFileCount 个(0 为不限)
+  Sink(const std::string& filename, bool enableConsole, size_t segmentSize,
+       size_t maxFileCount)
+      : hasInit_(true)
+      , enableConsole_(enableConsole) {
+    filename_ = filename;
+    mmap_     = std::make_unique<mmap_appender>(filename, segmentSize, maxFileCount, BOM_STR);
+    if (not mmap_->good()) {
+      reportError("map log segment error: ", std::error_code(errno, std::generic_category()));
+    }
+    detail::add_crash_target(this);
   }
+#endif
 
   void enableConsole(bool b) { enableConsole_ = b; }
 
+  /// @brief 切换滚动方式并重新打开日志文件.
+  /// SEQUENCE 模式从已有的最大编号继续写, 写满一半时后台线程提前打开下一个段,
+  /// 滚动时只需换上该段并在后台删除最旧的一个, 调用方不做任何文件元数据操作
+  void setRollMode(RollMode mode) {
+    std::lock_guard guard(mtx_);
+    if (mode == rollMode_ or not fileBacked()) return;
+    rollMode_ = mode;
+    reopenLogFile();
+  }
+
+  /// @brief 按本地时间每小时/每天切换到新文件(文件名带日期或小时), 与大小上限同时生效:
+  /// 周期内写满 fileMaxSize 时仍按滚动方式切分; maxFileCount > 1 时各周期的文件合计最多保留 maxFileCount 个,
+  /// 每次换到新周期时删除最旧的
+  void setRollInterval(RollInterval interval) {
+    std::lock_guard guard(mtx_);
+    if (interval == interval_ or not fileBacked()) return;
+    interval_ = interval;
+    if (interval == RollInterval::NONE) {
+      nextRollAt_.store(INT64_MAX, std::memory_order_relaxed);
+      baseName_ = filename_;
+      reopenLogFile();
+    } else {
+      rollInterval(std::chrono::system_clock::now());
+    }
+  }
+
+  /// @brief 在低优先级后台线程中压缩滚动出的日志段(SEQUENCE 段、按时间切分的上一周期文件以及内存映射段).
+  /// RENAME 方式滚动出的文件之后还会被重命名, 不会被压缩
+  /// @return 实际使用的压缩格式, 所需的库不可用时依次退回 GZIP / NONE
+  Compression setCompression(Compression method) {
+    std::lock_guard guard(mtx_);
+    method = segment_compressor::resolve(method);
+    if (preparer_) preparer_->setCompressor(nullptr);
+#ifndef _WIN32
+    if (mmap_) mmap_->setCompressor(nullptr);
+#endif
+    compressor_.reset();
+    if (method == Compression::NONE) return method;
+    compressor_ = std::make_unique<segment_compressor>(method);
+    if (preparer_) preparer_->setCompressor(compressor_.get());
+#ifndef _WIN32
+    if (mmap_) mmap_->setCompressor(compressor_.get());
+#endif
+    return method;
+  }
+
   void startThread() {
     writeFileThd_ = std::thread([this] {
+      std::vector<record_t> batch(XLOG_WRITE_BATCH_SIZE);
       while (not stopped_) {
-        rollLogFiles();
-        if (record_t buffer; queue_.try_dequeue(buffer)) {
-          enableConsole_ ? writeRecord<false, true>(buffer) //
-                         : writeRecord<false, false>(buffer);
+        if (size_t n = queue_.try_dequeue_bulk(batch.begin(), batch.size()); n > 0) {
+          markInFlight(batch.data(), n);
+          releaseSpace(n);
+          writeDeduped(batch.data(), n);
+          markInFlight(nullptr, 0);
+          releaseBatch(batch, n);
+          reportDropped(false);
+          continue;
         }
-        /// 当队列没有日志消息要写的时候 死等.
-        if (queue_.size_approx() > 0) continue;
+        reportDropped(false);
+        reportRepeats(false);
+        // 队列空闲时把缓冲区交给内核, 避免日志长时间停留在用户态
+        flushFile();
         std::unique_lock lock(queMtx_);
-        /// wait xxx until {...}
-        cnd_.wait(lock, [&] { return queue_.size_approx() > 0 or stopped_; });
+        writerIdle_.store(true, std::memory_order_release);
+        /// 当队列没有日志消息要写的时候等待, 超时兜底避免错过通知
+        cnd_.wait_for(lock, std::chrono::milliseconds(100),
+                      [&] { return queue_.size_approx() > 0 or stopped_; });
+        writerIdle_.store(false);
       }
     });
   }
@@ -229,115 +161,590 @@ public:
     }
   }
 
+  /// @brief 替换行格式, 之后写出的记录使用新格式
+  void setLayout(const detail::line_layout* layout) { layout_.store(layout, std::memory_order_release); }
+
+  /// @brief 在每个日志文件旁写稀疏时间索引 "<文件名>.idx", 每 interval 字节记录一项, 0 为关闭(默认).
+  /// 索引随文件一起滚动、重命名和删除; 内存映射模式不支持
+  /// @return 不支持时返回 false
+  bool setIndexInterval(size_t interval) {
+    std::lock_guard guard(mtx_);
+    if (not fileBacked()) return false;
+    indexInterval_ = interval;
+    if (interval == 0) {
+      index_.close();
+    } else if (file_.is_open()) {
+      index_.open(currentName_ + std::string(index_suffix), interval);
+    }
+    return true;
+  }
+
+  /// @brief 异步模式下合并连续重复的记录: 调用点、logger、内容和字段都相同的记录在 window 内只写出第一条,
+  /// 之后遇到不同的记录、空闲时超过 window 或重复持续超过 window 时补一行 "last message repeated N times";
+  /// 0 为关闭(默认)
+  void setDedupWindow(std::chrono::milliseconds window) {
+    dedupWindow_.store(std::chrono::duration_cast<std::chrono::system_clock::duration>(window).count(),
+                       std::memory_order_relaxed);
+  }
+
+  /// @brief 文件改为写二进制格式(见 binlog.hh), 控制台仍输出文本; 切换后从一个新的文件头开始.
+  /// 应在开始记录日志前设置一次
+  /// @return 内存映射模式或没有日志文件时不支持, 返回 false
+  bool setBinaryFormat(bool enable) {
+    std::lock_guard guard(mtx_);
+    if (not fileBacked()) return false;
+    if (enable == binary_.load(std::memory_order_relaxed)) return true;
+    binary_.store(enable, std::memory_order_relaxed);
+    reopenLogFile();
+    return true;
+  }
+
   template <bool synced = false, bool console = false>
   void writeRecord(record_t& record) {
+    record.resolveTime();
+    if (binary_.load(std::memory_order_relaxed)) [[unlikely]] {
+      writeBinary(&record, 1);
+      if constexpr (console) {
+        writeConsole(record);
+        std::cout << std::flush;
+      }
+      return;
+    }
+    thread_local std::string line;
+    line.clear();
+    layout_.load(std::memory_order_acquire)->plain(line, record);
+
+#ifndef _WIN32
+    if (mmap_) {
+      mmap_->append(line);
+      if constexpr (console) {
+        writeConsole(record);
+        std::cout << std::flush;
+      }
+      return;
+    }
+#endif
     std::lock_guard guard(IoStreamMtx<synced>());
-    if constexpr (synced) { rollLogFiles(); }
-
-    auto const timeStr  = helper::getTimeStr(record.getTimePoint());
-    auto const levelStr = helper::LevelStr(record.getLevel());
-    auto const tidStr   = helper::getTidBuf(record.getThreadId());
-    auto const fileStr  = record.getFileStr();
-    auto const msg      = record.getMessage();
-    auto const name     = record.getLoggerName();
-
-    writeFile(timeStr);
-    writeFile(" ");
-    writeFile(levelStr);
-    writeFile("[");
-    writeFile(name);
-    writeFile("] ");
-    writeFile(tidStr);
-    writeFile(fileStr);
-    writeFile(msg);
+    if constexpr (synced) {
+      if (intervalDue(record.getTimePoint())) [[unlikely]] { rollInterval(record.getTimePoint()); }
+      rollLogFiles();
+    }
+    int64_t const nanos = record.getTimePoint().time_since_epoch().count();
+    indexChunk(line.size(), nanos, nanos);
+    writeFile(line);
+    if (realTimeFlush_) file_.flush();
 
     if constexpr (console) {
-      std::cout << helper::addColor(record.getLevel());
-      std::cout << timeStr;
-      std::cout << ' ';
-      std::cout << levelStr;
-      std::cout << helper::cleanColor(record.getLevel());
-      std::cout << "[";
-      std::cout << name;
-      std::cout << "] ";
-      std::cout << tidStr;
-      std::cout << fileStr;
-      std::cout << helper::addColor(record.getLevel());
-      std::cout << msg;
-      std::cout << helper::cleanColor(record.getLevel());
+      writeConsole(record);
       std::cout << std::flush;
     }
   }
 
+  /// @brief 把一批记录格式化到同一块缓冲区, 一次写入文件, 每批只检查一次滚动;
+  /// 批内有记录跨过时间周期边界时, 边界之前的部分先写入旧文件
+  void writeBatch(record_t* records, size_t count) {
+    batchBuf_.clear();
+    bool const console = enableConsole_;
+    markInFlight(records, count);
+    if (binary_.load(std::memory_order_relaxed)) [[unlikely]] {
+      writeBinary(records, count);
+      if (console) {
+        for (size_t i = 0; i < count; ++i) writeConsole(records[i]);
+        std::cout << std::flush;
+      }
+      markInFlight(nullptr, 0);
+      return;
+    }
+    auto const layout  = layout_.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; ++i) {
+      records[i].resolveTime();
+      if (intervalDue(records[i].getTimePoint())) [[unlikely]] {
+        commitBatch();
+        std::lock_guard guard(mtx_);
+        rollInterval(records[i].getTimePoint());
+      }
+      layout->plain(batchBuf_, records[i]);
+      inFlightDone_.store(i + 1, std::memory_order_relaxed);
+      trackTime(records[i]);
+      if (console) writeConsole(records[i]);
+    }
+    if (console) std::cout << std::flush;
+    commitBatch();
+    markInFlight(nullptr, 0);
+  }
+
+  /// 记下写线程手上尚未格式化的记录, 写线程自己崩溃时 drainOnCrash 补写它们
+  void markInFlight(record_t* records, size_t count) {
+    inFlightCount_.store(0, std::memory_order_relaxed);
+    inFlightDone_.store(0, std::memory_order_relaxed);
+    inFlight_.store(records, std::memory_order_relaxed);
+    inFlightCount_.store(count, std::memory_order_relaxed);
+  }
+
   void write(record_t&& r) {
-    queue_.enqueue(std::move(r));
+    if (stopped_.load(std::memory_order_acquire)) [[unlikely]] {
+      // 写线程已停止(stopAsyncLog), 队列不再有人取走, 改为同步写出; 不占用队列容量
+      if (enableConsole_) {
+        writeRecord<true, true>(r);
+      } else {
+        writeRecord<true, false>(r);
+      }
+      return;
+    }
+    if (capacity_.load(std::memory_order_acquire) > 0 and not admit(r)) return;
+    if (not queue_.enqueue(std::move(r))) [[unlikely]] {
+      // 写线程已停止, 不再有人取走记录
+      droppedNewest_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
     cnd_.notify_all();
   }
 
+  /// @brief 限制异步队列的容量, capacity 为 0 表示不限制(默认)
+  /// @param policy    队列满时的处理方式
+  /// @param timeout   BLOCK_TIMEOUT 的最长等待时间
+  /// @param threshold DROP_BELOW_LEVEL 的阈值, 低于它的记录在队列满时被丢弃
+  void setOverflowPolicy(size_t capacity, OverflowPolicy policy,
+                         std::chrono::milliseconds timeout, Level threshold) {
+#ifdef XLOG_ENABLE_SPSC_QUEUE
+    // 生产者不能从单消费者的环形队列中取出记录
+    if (policy == OverflowPolicy::DROP_OLDEST) policy = OverflowPolicy::DROP_NEWEST;
+#endif
+    // 生产者先 acquire 读 capacity_, 再读这三项
+    policy_.store(policy, std::memory_order_relaxed);
+    timeout_.store(timeout, std::memory_order_relaxed);
+    threshold_.store(threshold, std::memory_order_relaxed);
+    capacity_.store(capacity, std::memory_order_release);
+    spaceCnd_.notify_all();
+  }
+
+  /// 各溢出策略的计数
+  overflow_stats overflowStats() const {
+    overflow_stats stats;
+    stats.blocked           = blocked_.load(std::memory_order_relaxed);
+    stats.timedOut          = timedOut_.load(std::memory_order_relaxed);
+    stats.droppedNewest     = droppedNewest_.load(std::memory_order_relaxed);
+    stats.droppedOldest     = droppedOldest_.load(std::memory_order_relaxed);
+    stats.droppedBelowLevel = droppedBelowLevel_.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+  /// @brief 等待写线程取空队列并写完手上的批次(最多 1 秒), 然后把缓冲的数据交给内核
   void flush() {
-    std::lock_guard guard(mtx_);
-    if (file_.is_open()) {
-      file_ << std::flush;
-      std::ofstream::sync_with_stdio();
-      file_.close();
+    if (writeFileThd_.joinable() and not stopped_) {
+      auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+      while ((queue_.size_approx() > 0 or not writerIdle_.load()) and
+             std::chrono::steady_clock::now() < deadline) {
+        cnd_.notify_all();
+        std::this_thread::yield();
+      }
     }
+    flushFile();
   }
 
   void stop() {
-    std::lock_guard guard(mtx_);
     if (not writeFileThd_.joinable()) return;
-    if (stopped_) return;
-    stopped_ = true;
+    {
+      std::lock_guard lock(queMtx_);
+      stopped_ = true;
+    }
+    queue_.close();
     cnd_.notify_all();
-    record_t record;
-    while (queue_.try_dequeue(record)) {
-      rollLogFiles();
-      enableConsole_ ? writeRecord<false, true>(record)
-                     : writeRecord<false, false>(record);
+    spaceCnd_.notify_all();
+    // 队列只允许一个消费者, 等写线程退出后再由当前线程写完剩余的记录
+    writeFileThd_.join();
+    std::vector<record_t> batch(XLOG_WRITE_BATCH_SIZE);
+    while (size_t n = queue_.try_dequeue_bulk(batch.begin(), batch.size())) {
+      releaseSpace(n);
+      writeDeduped(batch.data(), n);
+      releaseBatch(batch, n);
     }
+    reportRepeats(true);
+    reportDropped(true);
   }
 
   ~Sink() {
+    detail::remove_crash_target(this);
     stop();
-    if (writeFileThd_.joinable()) writeFileThd_.join();
+    file_.close();
+    index_.close();
   }
 
+#ifndef _WIN32
+  /// @brief 收到致命信号时调用, 见 crash_target.
+  /// 写线程正常运行时等它写完队列并 flush(它空闲下来就说明之前的记录都已交给内核);
+  /// 崩溃的就是写线程或同步模式时, 由当前线程把文件缓冲区交给内核, 再用紧急格式写出队列中剩余的记录
+  void drainOnCrash(int64_t deadline) noexcept override {
+    if (mmap_) return; // 生产者直接写进映射内存, 已经在 page cache 中
+    bool const onWriter = writeFileThd_.joinable() and std::this_thread::get_id() == writeFileThd_.get_id();
+    if (writeFileThd_.joinable() and not onWriter) {
+      while (not (writerIdle_.load(std::memory_order_acquire) and queue_.size_approx() == 0)) {
+        // 超时就放弃, 不与仍在运行的写线程同时写文件
+        if (detail::crash_clock() >= deadline) return;
+        detail::crash_sleep(1'000'000);
+      }
+      return;
+    }
+    if (file_.fd() < 0) return;
+    // 有线程(可能就是崩溃的线程)正在用文件时不碰 file_ 的缓冲区
+    bool const claimed = mtx_.tryClaim();
+    if (claimed) file_.flush();
+    if (onWriter) {
+      // 二进制文件中不能混入文本, 文件不能直接追加(io_uring)时也一样, 剩余的记录改写到 stderr
+      int const fd = binary_.load(std::memory_order_relaxed) or file_.appendFd() < 0 ? STDERR_FILENO : file_.fd();
+      char      line[1024];
+      // 只读取记录, 不换算 TSC(tsc_clock 会加锁)也不格式化延迟参数(会分配内存)
+      auto const emergency = [&](const record_t& record) {
+        std::string_view const message = record.isDeferred() ? record.getDeferredFormat() : record.getRawContent();
+        size_t const len = detail::format_crash_line(line, sizeof(line), detail::crash_stamp_nanos(record.getStamp()),
+                                                     record.getLevel(), record.getLoggerName(), record.getThreadId(),
+                                                     record.getFileStr(), message);
+        detail::crash_write(fd, line, len);
+        return detail::crash_clock() < deadline;
+      };
+      // 正在写的批次: 已经格式化但还没交给 file_ 的部分, 以及还没格式化的记录.
+      // batchBuf_ 只属于写线程, 崩溃在 commitBatch 中时也照样写出, 宁可重复不丢失
+      if (not batchBuf_.empty()) detail::crash_write(fd, batchBuf_.data(), batchBuf_.size());
+      record_t* const batch = inFlight_.load(std::memory_order_relaxed);
+      size_t const    count = inFlightCount_.load(std::memory_order_relaxed);
+      bool            more  = true;
+      for (size_t i = inFlightDone_.load(std::memory_order_relaxed); more and i < count; ++i) {
+        more = emergency(batch[i]);
+      }
+      if (more) queue_.crash_drain(emergency);
+    }
+    if (claimed) mtx_.release();
+  }
+
+  int crashFd() noexcept override { return mmap_ or binary_.load(std::memory_order_relaxed) ? -1 : file_.appendFd(); }
+#else
+  void drainOnCrash(int64_t) noexcept override {}
+
+  int crashFd() noexcept override { return -1; }
+#endif
+
 private:
-  void openLogFile() {
+  void flushFile() {
+    std::lock_guard guard(mtx_);
+    if (file_.flush()) return;
+    reportError("write log file error: ", file_.error());
+  }
+
+  /// @brief 有容量限制时为一条记录占位, 队列已满时按策略处理
+  /// @return false 表示该条记录被丢弃
+  bool admit(const record_t& r) {
+    size_t const capacity = capacity_.load(std::memory_order_acquire);
+    if (pending_.fetch_add(1, std::memory_order_relaxed) < static_cast<int64_t>(capacity)) [[likely]] {
+      return true;
+    }
+    switch (policy_.load(std::memory_order_relaxed)) {
+    case OverflowPolicy::DROP_NEWEST:
+      pending_.fetch_sub(1, std::memory_order_relaxed);
+      droppedNewest_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    case OverflowPolicy::DROP_BELOW_LEVEL:
+      if (r.getLevel() >= threshold_.load(std::memory_order_relaxed)) return true;
+      pending_.fetch_sub(1, std::memory_order_relaxed);
+      droppedBelowLevel_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    case OverflowPolicy::DROP_OLDEST: {
+      // 取走一条最旧的记录, 它原来占的位置让给新记录
+      record_t oldest;
+      if (queue_.try_dequeue(oldest)) {
+        pending_.fetch_sub(1, std::memory_order_relaxed);
+        droppedOldest_.fetch_add(1, std::memory_order_relaxed);
+      }
+      return true;
+    }
+    default:
+      return waitForSpace(capacity);
+    }
+  }
+
+  /// @brief BLOCK / BLOCK_TIMEOUT: 等写线程腾出空间; 写线程已停止时不再等待, 由 write 同步写出
+  bool waitForSpace(size_t capacity) {
+    blocked_.fetch_add(1, std::memory_order_relaxed);
+    bool const timed    = policy_.load(std::memory_order_relaxed) == OverflowPolicy::BLOCK_TIMEOUT;
+    auto const deadline = std::chrono::steady_clock::now() + timeout_.load(std::memory_order_relaxed);
+    pending_.fetch_sub(1, std::memory_order_relaxed);
+    waiters_.fetch_add(1, std::memory_order_relaxed);
+    std::unique_lock lock(spaceMtx_);
+    for (;;) {
+      int64_t pending = pending_.load(std::memory_order_relaxed);
+      while (pending < static_cast<int64_t>(capacity) or stopped_.load(std::memory_order_acquire)) {
+        if (pending_.compare_exchange_weak(pending, pending + 1, std::memory_order_relaxed)) {
+          waiters_.fetch_sub(1, std::memory_order_relaxed);
+          return true;
+        }
+      }
+      if (timed and std::chrono::steady_clock::now() >= deadline) break;
+      // 写线程每批之后会通知, 超时兜底避免错过通知
+      spaceCnd_.wait_for(lock, std::chrono::milliseconds(10));
+      capacity = capacity_.load(std::memory_order_relaxed);
+      if (capacity == 0) capacity = SIZE_MAX >> 1;
+    }
+    waiters_.fetch_sub(1, std::memory_order_relaxed);
+    timedOut_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  /// @brief 写完一批后清空取出记录的槽位: 否则它们一直引用生产者线程的 arena 块,
+  /// 直到下一次取出时才被覆盖, 生产者找不到空闲的块只能退回 operator new
+  static void releaseBatch(std::vector<record_t>& batch, size_t n) {
+    for (size_t i = 0; i < n; ++i) batch[i] = record_t{};
+  }
+
+  /// 写线程取出 n 条记录后释放它们占的位置
+  void releaseSpace(size_t n) {
+    if (pending_.fetch_sub(static_cast<int64_t>(n), std::memory_order_relaxed) < static_cast<int64_t>(n)) {
+      // 限制是在队列非空时才打开的, 计数偏小, 归零即可
+      pending_.store(0, std::memory_order_relaxed);
+    }
+    if (waiters_.load(std::memory_order_relaxed) > 0) spaceCnd_.notify_all();
+  }
+
+  /// @brief 把自上次以来因溢出丢弃的条数作为一行日志写出, 至多每秒一次
+  void reportDropped(bool force) {
+    uint64_t const total = overflowStats().dropped();
+    if (total == reportedDrops_) return;
+    auto const now = std::chrono::steady_clock::now();
+    if (not force and now - lastDropReport_ < std::chrono::seconds(1)) return;
+    record_t record(std::chrono::system_clock::now(), &detail::internal_site<Level::WARN>);
+    record.setLoggerName("xlog");
+    record << total - reportedDrops_ << " records dropped by queue overflow";
+    reportedDrops_  = total;
+    lastDropReport_ = now;
+    writeBatch(&record, 1);
+  }
+
+  /// @brief 写线程: 去掉与上一条写出的记录重复的记录后写出, 不同的记录不会因此被推迟
+  void writeDeduped(record_t* records, size_t count) {
+    int64_t const window = dedupWindow_.load(std::memory_order_relaxed);
+    if (window == 0) {
+      reportRepeats(true);
+      writeBatch(records, count);
+      return;
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < count; ++i) {
+      record_t& record = records[i];
+      record.resolveTime();
+      int64_t const now = record.getTimePoint().time_since_epoch().count();
+      if (now - runStart_ < window and isRepeat(record)) {
+        ++repeats_;
+        lastRepeat_ = now;
+        continue;
+      }
+      if (repeats_ > 0) {
+        // 重复到此为止, 之前保留的记录和统计行按顺序写出
+        if (kept > 0) writeBatch(records, kept);
+        kept = 0;
+        reportRepeats(true);
+      }
+      remember(record, now);
+      if (kept != i) records[kept] = std::move(record);
+      ++kept;
+    }
+    if (kept > 0) writeBatch(records, kept);
+  }
+
+  bool isRepeat(const record_t& record) const {
+    return &record.getSite() == lastSite_ and record.getLoggerName().data() == lastLogger_.data() and
+           record.getDeferredFormat().data() == lastFormat_ and record.getRawContent() == lastContent_ and
+           record.getFields() == lastFields_;
+  }
+
+  void remember(const record_t& record, int64_t time) {
+    lastSite_   = &record.getSite();
+    lastLogger_ = record.getLoggerName();
+    lastFormat_ = record.getDeferredFormat().data();
+    lastTid_    = record.getThreadId();
+    lastContent_.assign(record.getRawContent());
+    lastFields_.assign(record.getFields());
+    runStart_ = time;
+  }
+
+  /// @brief 写出被合并的次数, 位置和线程与重复的记录相同; 不强制时等到重复开始后超过窗口才写
+  void reportRepeats(bool force) {
+    if (repeats_ == 0) return;
+    if (not force and std::chrono::system_clock::now().time_since_epoch().count() - runStart_ <
+                          dedupWindow_.load(std::memory_order_relaxed)) {
+      return;
+    }
+    record_t record(log_stamp{lastRepeat_, false}, lastSite_);
+    record.setLoggerName(lastLogger_);
+    record.restore(lastTid_, {});
+    record << "last message repeated " << repeats_ << " times";
+    repeats_ = 0;
+    writeBatch(&record, 1);
+  }
+
+  /// @brief 二进制格式: 编码器的字典跟着文件走, 所以先检查滚动再编码, 编码和写入都持有 mtx_,
+  /// 每个段都从文件头和自己的字典开始
+  void writeBinary(record_t* records, size_t count) {
+    std::lock_guard guard(mtx_);
+    rollLogFiles();
+    binaryBuf_.clear();
+    for (size_t i = 0; i < count; ++i) {
+      records[i].resolveTime();
+      if (intervalDue(records[i].getTimePoint())) [[unlikely]] {
+        indexBatch(binaryBuf_.size());
+        writeFile(binaryBuf_);
+        binaryBuf_.clear();
+        rollInterval(records[i].getTimePoint());
+      }
+      encoder_.encode(binaryBuf_, records[i]);
+      trackTime(records[i]);
+    }
+    indexBatch(binaryBuf_.size());
+    writeFile(binaryBuf_);
+    if (realTimeFlush_) file_.flush();
+  }
+
+  void commitBatch() {
+    if (batchBuf_.empty()) return;
+#ifndef _WIN32
+    if (mmap_) {
+      mmap_->append(batchBuf_);
+      batchBuf_.clear();
+      return;
+    }
+#endif
+    std::lock_guard guard(mtx_);
+    rollLogFiles();
+    indexBatch(batchBuf_.size());
+    writeFile(batchBuf_);
+    if (realTimeFlush_) file_.flush();
+    batchBuf_.clear();
+  }
+
+  /// 批内记录的时间范围, 写出时登记到索引
+  void trackTime(const record_t& record) {
+    int64_t const nanos = record.getTimePoint().time_since_epoch().count();
+    batchMinTime_       = (std::min)(batchMinTime_, nanos);
+    batchMaxTime_       = (std::max)(batchMaxTime_, nanos);
+  }
+
+  /// 登记当前批次的 length 字节, 调用方需持有 mtx_
+  void indexBatch(size_t length) {
+    indexChunk(length, batchMinTime_, batchMaxTime_);
+    batchMinTime_ = INT64_MAX;
+    batchMaxTime_ = INT64_MIN;
+  }
+
+  /// @brief 把即将写到当前文件末尾的 length 字节及其中记录的时间范围登记到索引, 调用方需持有 mtx_
+  void indexChunk(size_t length, int64_t minTime, int64_t maxTime) {
+    if (indexInterval_ == 0 or length == 0 or not index_.is_open()) return;
+    auto const nanos = [](int64_t ticks) {
+      using duration = std::chrono::system_clock::duration;
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(duration(ticks)).count();
+    };
+    index_.add(currFileSize_, length, nanos(minTime), nanos(maxTime));
+  }
+
+  bool fileBacked() const {
+#ifndef _WIN32
+    if (mmap_) return false;
+#endif
+    return not filename_.empty();
+  }
+
+  /// 记录时间是否已到达下一个周期, 每条记录只做一次整数比较
+  bool intervalDue(const std::chrono::system_clock::time_point& tp) const {
+    return tp.time_since_epoch().count() >= nextRollAt_.load(std::memory_order_relaxed);
+  }
+
+  /// @brief 切换到 tp 所在周期的文件并算出下一个边界, 调用方需持有 mtx_
+  void rollInterval(std::chrono::system_clock::time_point tp) {
+    roll_period period = period_of(interval_, tp);
+    nextRollAt_.store(period.nextBoundary, std::memory_order_relaxed);
+    baseName_ = segment_name(filename_, period.label);
+    std::string closed = currentName_;
+    reopenLogFile();
+    if (maxFileCount_ > 1) prune_period_files(filename_, period.label, maxFileCount_, rollMode_);
+    std::error_code ec;
+    if (compressor_ and std::filesystem::exists(closed, ec)) { compressor_->enqueue(std::move(closed)); }
+  }
+
+  /// @brief 关闭当前文件, 按当前的滚动方式和基础文件名重新打开, 调用方需持有 mtx_
+  void reopenLogFile() {
+    file_.close();
+    index_.close();
+    preparer_.reset();
+    // 只写了 BOM 或文件头的文件不再保留
+    std::error_code ec;
+    if (std::filesystem::file_size(currentName_, ec) <= fileHeaderSize() and not ec) {
+      std::filesystem::remove(currentName_, ec);
+      std::filesystem::remove(currentName_ + std::string(index_suffix), ec);
+    }
+    if (rollMode_ == RollMode::SEQUENCE) {
+      seq_ = last_segment_seq(baseName_);
+      if (seq_ == 0 or std::filesystem::file_size(segment_name(baseName_, seq_), ec) > fileMaxSize_) {
+        ++seq_;
+      }
+      preparer_ = std::make_unique<segment_preparer>(baseName_, file_.openFlags());
+      preparer_->setCompressor(compressor_.get());
+      if (maxFileCount_ > 0 and seq_ > static_cast<uint64_t>(maxFileCount_)) {
+        preparer_->purgeUpTo(seq_ - maxFileCount_);
+      }
+    }
+    openLogFile();
+  }
+
+  /// @brief 打开日志文件; 失败时只报告一次错误, 之后该 Sink 的文件输出被丢弃
+  bool openLogFile() {
     currFileSize_        = 0;
     std::string filename = buildFilename();
+    currentName_         = filename;
+    std::error_code ec;
 
     if (std::filesystem::path(filename).has_parent_path()) {
-      std::error_code ec;
-      auto            parent = std::filesystem::path(filename).parent_path();
+      auto parent = std::filesystem::path(filename).parent_path();
       std::filesystem::create_directories(parent, ec);
       if (ec) {
-        std::cout << "create directories error: " << ec.message() << std::flush;
-        abort();
+        reportError("create directories error: ", ec);
+        return false;
       }
     }
 
-    file_.open(filename, std::ios::binary | std::ios::out | std::ios::app);
-    if (file_) {
-      std::error_code ec;
-      size_t          _fileSize = std::filesystem::file_size(filename, ec);
-      if (ec) {
-        std::cout << "get file size error" << std::flush;
-        abort();
-      }
+    if (not file_.open(filename, ec)) {
+      reportError("open log file error: ", ec);
+      return false;
+    }
+    beginFile();
+    return true;
+  }
 
-      if (_fileSize == 0) {
-        if (file_.write(BOM_STR.data(), BOM_STR.size())) {
-          currFileSize_ += BOM_STR.size();
-        }
-      }
+  /// @brief 刚打开的文件: 文本格式在空文件开头写 BOM;
+  /// 二进制格式每次打开都写文件头并清空字典, 追加到已有文件时解码器从这里重新开始
+  void beginFile() {
+    if (binary_.load(std::memory_order_relaxed)) {
+      std::string header;
+      encoder_.begin(header);
+      file_.append(header);
+    } else if (file_.size() == 0) {
+      file_.append(BOM_STR);
     }
+    currFileSize_ = file_.size();
+    if (indexInterval_ > 0) index_.open(currentName_ + std::string(index_suffix), indexInterval_);
+  }
+
+  size_t fileHeaderSize() const {
+    return binary_.load(std::memory_order_relaxed) ? detail::binlog_magic.size() : BOM_STR.size();
+  }
+
+  void reportError(std::string_view what, std::error_code ec) {
+    if (errorReported_) return;
+    errorReported_ = true;
+    std::cerr << "[xlog] " << what << filename_ << ": " << ec.message() << std::endl;
   }
 
   std::string buildFilename(int fileIndex = 0) {
-    if (fileIndex == 0) { return filename_; }
+    if (fileIndex == 0) {
+      return rollMode_ == RollMode::SEQUENCE ? segment_name(baseName_, seq_) : baseName_;
+    }
 
-    auto        filePath = std::filesystem::path(filename_);
+    auto        filePath = std::filesystem::path(baseName_);
     std::string filename = filePath.stem().string();
 
     if (fileIndex > 0) {
@@ -358,49 +765,154 @@ private:
   }
 
   void rollLogFiles() {
-    if (maxFileCount_ <= 0 or currFileSize_ <= fileMaxSize_ or
-        static_cast<size_t>(-1) == currFileSize_) {
-      return;
-    }
+    if (maxFileCount_ <= 0 or static_cast<size_t>(-1) == currFileSize_) { return; }
+    if (rollMode_ == RollMode::SEQUENCE) { return rollSegment(); }
+    if (currFileSize_ <= fileMaxSize_) { return; }
     file_.close();
+    index_.close();
     std::string const lastFilename{ buildFilename(maxFileCount_ - 1) };
 
     std::error_code ec;
     std::filesystem::remove(lastFilename, ec);
+    std::filesystem::remove(lastFilename + std::string(index_suffix), ec);
 
     for (int fileIndex = maxFileCount_ - 2; fileIndex >= 0; --fileIndex) {
       std::string currentFileName = buildFilename(fileIndex);
       std::string nextFileName    = buildFilename(fileIndex + 1);
       std::filesystem::rename(currentFileName, nextFileName, ec);
+      if (indexInterval_ > 0) {
+        std::filesystem::rename(currentFileName + std::string(index_suffix), nextFileName + std::string(index_suffix),
+                                ec);
+      }
     }
     openLogFile();
   }
 
+  /// @brief SEQUENCE 模式的滚动: 换上后台提前打开的下一个段,
+  /// 旧段的关闭和最旧段的删除都交给后台线程
+  void rollSegment() {
+    if (currFileSize_ >= fileMaxSize_ / 2) { preparer_->prepare(seq_ + 1); }
+    if (currFileSize_ <= fileMaxSize_) { return; }
+
+    int const   next   = preparer_->take(seq_ + 1);
+    int const   prev   = file_.release();
+    std::string closed = currentName_;
+    ++seq_;
+    if (next >= 0) {
+      file_.adopt(next);
+      currentName_ = buildFilename();
+      beginFile();
+    } else {
+      // 后台线程还没来得及打开时才在当前线程同步打开
+      openLogFile();
+    }
+    uint64_t const expired = seq_ > static_cast<uint64_t>(maxFileCount_) ? seq_ - maxFileCount_ : 0;
+    preparer_->retire(prev, std::move(closed), expired);
+  }
+
+  /// 按同一个格式再生成一份带颜色的行输出到控制台
+  void writeConsole(record_t& record) {
+    thread_local std::string line;
+    line.clear();
+    layout_.load(std::memory_order_acquire)->colored(line, record);
+    std::cout << line;
+  }
+
   void writeFile(std::string_view str) {
-    if (not hasInit_) return;
-    file_ << str;
-    if (realTimeFlush_) file_ << std::flush;
+    if (not file_.is_open()) return;
+    file_.append(str);
     currFileSize_ += str.size();
   }
 
   bool        hasInit_ = false; // 全局logger是否已经被实例化
+  /// 行格式, 默认为 XLOG_DEFAULT_PATTERN
+  std::atomic<const detail::line_layout*> layout_{&detail::layout_of<XLOG_DEFAULT_PATTERN>};
+  /// 文件是否写二进制格式, 编码器和 binaryBuf_ 只在持有 mtx_ 时使用
+  std::atomic<bool>      binary_{false};
+  detail::binary_encoder encoder_;
+  std::string            binaryBuf_;
+  /// 时间索引, 只在持有 mtx_ 时使用; indexInterval_ 为 0 时不写索引
+  detail::index_writer index_;
+  size_t               indexInterval_ = 0;
+  /// 当前批次中记录的时间范围(system_clock tick)
+  int64_t batchMinTime_ = INT64_MAX;
+  int64_t batchMaxTime_ = INT64_MIN;
   std::string filename_;
 
   bool   enableConsole_ = false;
+  bool   errorReported_ = false;
   bool   realTimeFlush_{};
   int    maxFileCount_ = 0;
   size_t currFileSize_ = 0; // B
   size_t fileMaxSize_  = 0;
+  RollMode rollMode_    = RollMode::RENAME;
+  uint64_t seq_         = 0; // SEQUENCE 模式下当前段的编号
+  RollInterval interval_ = RollInterval::NONE;
+  /// 当前周期的基础文件名, 未按时间切分时即 filename_
+  std::string baseName_;
+  /// 正在写入的文件名
+  std::string currentName_;
+  /// 下一个时间周期的起点(system_clock tick), 不按时间切分时为最大值
+  std::atomic<int64_t> nextRollAt_{INT64_MAX};
 
   /// 输出流
-  std::shared_mutex mtx_;
-  empty_mutex       empty_;
-  std::ofstream     file_;
+  detail::crash_mutex mtx_;
+  empty_mutex         empty_;
+  file_writer         file_;
+  /// 压缩线程要比引用它的 preparer_ 和 mmap_ 后析构
+  std::unique_ptr<segment_compressor> compressor_;
+  std::unique_ptr<segment_preparer>   preparer_;
+#ifndef _WIN32
+  std::unique_ptr<mmap_appender> mmap_;
+#endif
 
-  std::mutex queMtx_;
+  /// 异步队列的容量限制, 0 为不限制
+  std::atomic<size_t>                    capacity_{0};
+  std::atomic<OverflowPolicy>            policy_{OverflowPolicy::BLOCK};
+  std::atomic<std::chrono::milliseconds> timeout_{std::chrono::milliseconds(10)};
+  std::atomic<Level>                     threshold_{Level::WARN};
+  /// 已占位但尚未被写线程取走的记录数
+  alignas(detail::cache_line_size) std::atomic<int64_t> pending_{0};
+  std::atomic<uint32_t>     waiters_{0};
+  std::mutex                spaceMtx_;
+  std::condition_variable   spaceCnd_;
+  std::atomic<uint64_t>     blocked_{0};
+  std::atomic<uint64_t>     timedOut_{0};
+  std::atomic<uint64_t>     droppedNewest_{0};
+  std::atomic<uint64_t>     droppedOldest_{0};
+  std::atomic<uint64_t>     droppedBelowLevel_{0};
+  /// 写线程私有: 上次报告时的丢弃总数和时间
+  uint64_t                              reportedDrops_ = 0;
+  std::chrono::steady_clock::time_point lastDropReport_{};
 
-  moodycamel::ConcurrentQueue<record_t> queue_;
+  std::mutex queMtx_;
+  /// 重复记录合并的窗口(system_clock tick), 0 为关闭
+  std::atomic<int64_t> dedupWindow_{0};
+  /// 写线程私有: 最近一条写出的记录和之后被合并的次数
+  const detail::call_site* lastSite_   = nullptr;
+  std::string_view         lastLogger_;
+  const char*              lastFormat_ = nullptr;
+  uint32_t                 lastTid_    = 0;
+  std::string              lastContent_;
+  std::string              lastFields_;
+  int64_t                  runStart_   = 0;
+  int64_t                  lastRepeat_ = 0;
+  uint64_t                 repeats_    = 0;
+  /// 写线程批量格式化用的缓冲区
+  std::string batchBuf_;
+
+#ifdef XLOG_ENABLE_SPSC_QUEUE
+  thread_ring_queue<record_t> queue_;
+#else
+  shared_queue<record_t> queue_;
+#endif
   std::thread writeFileThd_;
+  /// 写线程已写完队列并 flush, 正在等待新的记录
+  std::atomic<bool> writerIdle_{false};
+  /// 写线程手上的批次和其中已经格式化的条数, 见 markInFlight
+  std::atomic<record_t*> inFlight_{nullptr};
+  std::atomic<size_t>    inFlightCount_{0};
+  std::atomic<size_t>    inFlightDone_{0};
   std::condition_variable cnd_;
   std::atomic<bool> stopped_ = false;
 };
@@ -0,0 +1,129 @@
+//
+// xlog / time_index.hh
+// Created by brian on 2024-08-11.
+//
+
+#ifndef XLOG_TIME_INDEX_HH
+#define XLOG_TIME_INDEX_HH
+
+#include "xlog/detail/file_writer.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace xlog::detail {
+/// 索引文件以它开头, 之后是连续的 index_entry
+constexpr inline std::string_view index_magic{"XLOGIDX\x01", 8};
+
+/// @brief 索引项: 日志文件中 [offset, offset + length) 这段字节里的记录, 时间都在 [minTime, maxTime] 内(纳秒).
+/// 同时保存最小值和最大值, 异步写出时不同线程的记录略有乱序也不会漏查
+struct index_entry {
+  uint64_t offset  = 0;
+  uint64_t length  = 0;
+  int64_t  minTime = 0;
+  int64_t  maxTime = 0;
+};
+
+/// @brief 日志段旁边的稀疏时间索引 "<段文件名>.idx": 每写满 interval 字节记录一项.
+/// 一项在对应的字节写完时才落到文件中, 尚未记录的末尾部分由查询方整体扫描
+/// @note 非线程安全, 由 Sink 在持有文件锁时调用
+class index_writer {
+public:
+  /// @brief 打开(追加到)索引文件, 之前打开的索引会先关闭
+  bool open(const std::string& path, uint64_t interval) {
+    close();
+    std::error_code ec;
+    if (not file_.open(path, ec)) return false;
+    if (file_.size() == 0) file_.append(index_magic);
+    interval_ = interval;
+    return true;
+  }
+
+  /// @brief 写出未满一个间隔的最后一项并关闭
+  void close() {
+    if (not file_.is_open()) return;
+    commit();
+    file_.close();
+  }
+
+  bool is_open() const { return file_.is_open(); }
+
+  /// @brief 登记即将写到日志文件 offset 处的 length 字节, 其中记录的时间范围为 [minTime, maxTime]
+  void add(uint64_t offset, uint64_t length, int64_t minTime, int64_t maxTime) {
+    if (pending_.length > 0 and pending_.offset + pending_.length != offset) commit();
+    if (pending_.length == 0) {
+      pending_ = {offset, 0, minTime, maxTime};
+    } else {
+      pending_.minTime = (std::min)(pending_.minTime, minTime);
+      pending_.maxTime = (std::max)(pending_.maxTime, maxTime);
+    }
+    pending_.length += length;
+    if (pending_.length >= interval_) commit();
+  }
+
+private:
+  void commit() {
+    if (pending_.length == 0) return;
+    file_.append(std::string_view(reinterpret_cast<const char*>(&pending_), sizeof(pending_)));
+    file_.flush();
+    pending_ = {};
+  }
+
+  file_writer file_{256};
+  index_entry pending_{};
+  uint64_t    interval_ = 0;
+};
+
+/// @brief 读取整个索引文件
+/// @return 文件不存在或不是索引文件时返回 false
+inline bool read_index(const std::string& path, std::vector<index_entry>& entries) {
+  entries.clear();
+  std::FILE* in = std::fopen(path.c_str(), "rb");
+  if (in == nullptr) return false;
+  char magic[8];
+  bool ok = std::fread(magic, 1, sizeof(magic), in) == sizeof(magic) and
+            std::memcmp(magic, index_magic.data(), sizeof(magic)) == 0;
+  index_entry entry;
+  while (ok and std::fread(&entry, sizeof(entry), 1, in) == 1) entries.push_back(entry);
+  std::fclose(in);
+  return ok;
+}
+
+/// @brief 与 [from, to] 有交集的索引项覆盖的字节范围, 相邻的范围合并.
+/// 用前缀最大值和后缀最小值把候选区间二分到 [lo, hi), 其中再逐项比较
+inline std::vector<std::pair<uint64_t, uint64_t>> index_ranges(const std::vector<index_entry>& entries, int64_t from,
+                                                               int64_t to) {
+  std::vector<std::pair<uint64_t, uint64_t>> ranges;
+  size_t const                               n = entries.size();
+  std::vector<int64_t>                       prefixMax(n), suffixMin(n);
+  for (size_t i = 0; i < n; ++i) {
+    prefixMax[i] = i == 0 ? entries[i].maxTime : (std::max)(prefixMax[i - 1], entries[i].maxTime);
+  }
+  for (size_t i = n; i-- > 0;) {
+    suffixMin[i] = i + 1 == n ? entries[i].minTime : (std::min)(suffixMin[i + 1], entries[i].minTime);
+  }
+  // lo 之前的项最大时间都早于 from, hi 之后的项最小时间都晚于 to
+  size_t const lo = std::partition_point(prefixMax.begin(), prefixMax.end(), [&](int64_t t) { return t < from; }) -
+                    prefixMax.begin();
+  size_t const hi = std::partition_point(suffixMin.begin(), suffixMin.end(), [&](int64_t t) { return t <= to; }) -
+                    suffixMin.begin();
+  for (size_t i = lo; i < hi; ++i) {
+    auto const& e = entries[i];
+    if (e.maxTime < from or e.minTime > to) continue;
+    if (not ranges.empty() and ranges.back().second == e.offset) {
+      ranges.back().second = e.offset + e.length;
+    } else {
+      ranges.emplace_back(e.offset, e.offset + e.length);
+    }
+  }
+  return ranges;
+}
+} // namespace xlog::detail
+
+#endif // XLOG_TIME_INDEX_HH
@@ -8,12 +8,21 @@
 
 #include <array>
 #include <chrono>
+#include <cstdint>
 #include <cstring>
 #include <ctime>
 #include <string_view>
 
 namespace xlog {
 enum class time_format { http_format, utc_format, utc_without_punctuation_format };
+
+/// @brief 日志时间按哪个时区输出
+enum class TimeZone {
+  /// 本地时区, 偏移量按线程缓存到下一次夏令时切换
+  LOCAL,
+  UTC,
+};
+
 namespace time_util {
 /*
   IMF-fixdate = day-name "," SP date1 SP time-of-day SP GMT
@@ -326,6 +335,159 @@ travel_done:
   return faster_mktime(year, month, day, hour, min, sec, day_of_week);
 }
 
+/// @brief 由 unix 秒数直接换算出的公历时间, 不经过 gmtime/localtime
+struct civil_time {
+  int      year   = 1970;
+  unsigned month  = 1; // 1-12
+  unsigned day    = 1; // 1-31
+  unsigned hour   = 0;
+  unsigned minute = 0;
+  unsigned second = 0;
+  unsigned wday   = 4; // 0 = 星期日
+};
+
+constexpr int64_t floor_div(int64_t a, int64_t b) { return a / b - ((a % b != 0) and ((a < 0) != (b < 0))); }
+
+/// 1970-01-01 起的天数, 算法见 Howard Hinnant, "chrono-Compatible Low-Level Date Algorithms"
+constexpr int64_t days_from_civil(int64_t y, unsigned m, unsigned d) {
+  y -= m <= 2;
+  int64_t const  era = floor_div(y, 400);
+  auto const     yoe = static_cast<unsigned>(y - era * 400);
+  unsigned const doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  unsigned const doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+constexpr civil_time civil_from_unix(int64_t sec) {
+  int64_t const days = floor_div(sec, seconds_per_day);
+  auto const    rem  = static_cast<unsigned>(sec - days * seconds_per_day);
+
+  int64_t const  z   = days + 719468;
+  int64_t const  era = floor_div(z, 146097);
+  auto const     doe = static_cast<unsigned>(z - era * 146097);
+  unsigned const yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  unsigned const doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  unsigned const mp  = (5 * doy + 2) / 153;
+
+  civil_time t;
+  t.day    = doy - (153 * mp + 2) / 5 + 1;
+  t.month  = mp < 10 ? mp + 3 : mp - 9;
+  t.year   = static_cast<int>(static_cast<int64_t>(yoe) + era * 400 + (t.month <= 2));
+  t.hour   = rem / 3600;
+  t.minute = rem / 60 % 60;
+  t.second = rem % 60;
+  t.wday   = static_cast<unsigned>((days % 7 + 11) % 7); // 1970-01-01 是星期四
+  return t;
+}
+
+/// @brief 本地时区相对 UTC 的偏移(秒), 缓存 [begin, end) 区间内都有效的值.
+/// 缓存失效时才调用 localtime_r, 并向后按天探测、二分查找下一次夏令时切换的精确秒数,
+/// 每个线程一份, 平时不会碰到 localtime 的全局时区锁
+class utc_offset_cache {
+public:
+  int32_t offsetAt(int64_t sec) {
+    if (sec >= begin_ and sec < end_) [[likely]] { return offset_; }
+    refresh(sec);
+    return offset_;
+  }
+
+  /// 每次刷新最多向后探测的天数, 之后重新确认一次
+  static constexpr int64_t horizon_days = 7;
+
+  /// @brief 直接查询 sec 时刻的偏移
+  static int32_t query(int64_t sec) {
+    auto const t = static_cast<std::time_t>(sec);
+    std::tm    local{};
+#ifdef _WIN32
+    localtime_s(&local, &t);
+#else
+    localtime_r(&t, &local);
+#endif
+    int64_t const wall = days_from_civil(local.tm_year + 1900, local.tm_mon + 1, local.tm_mday) * seconds_per_day +
+                         local.tm_hour * seconds_per_hour + local.tm_min * seconds_per_minute + local.tm_sec;
+    return static_cast<int32_t>(wall - sec);
+  }
+
+private:
+  void refresh(int64_t sec) {
+    offset_ = query(sec);
+    end_    = sec + horizon_days * seconds_per_day;
+    for (int64_t d = 1; d <= horizon_days; ++d) {
+      int64_t const probe = sec + d * seconds_per_day;
+      if (query(probe) != offset_) {
+        end_ = transition(probe - seconds_per_day, probe, offset_);
+        break;
+      }
+    }
+    // 多个线程的记录在写线程上可能略有乱序, 向前也覆盖一天
+    int64_t const  back       = sec - seconds_per_day;
+    int32_t const  backOffset = query(back);
+    begin_ = backOffset == offset_ ? back : transition(back, sec, backOffset);
+  }
+
+  /// @brief 在 (lo, hi] 中二分查找偏移第一次不等于 offset 的秒数
+  static int64_t transition(int64_t lo, int64_t hi, int32_t offset) {
+    while (hi - lo > 1) {
+      int64_t const mid = lo + (hi - lo) / 2;
+      if (query(mid) == offset) {
+        lo = mid;
+      } else {
+        hi = mid;
+      }
+    }
+    return hi;
+  }
+
+  int64_t begin_  = 0;
+  int64_t end_    = 0;
+  int32_t offset_ = 0;
+};
+
+/// @brief sec 时刻本地时区的偏移, 线程内缓存
+inline int32_t local_utc_offset(int64_t sec) {
+  thread_local utc_offset_cache cache;
+  return cache.offsetAt(sec);
+}
+
+/// @brief 按时区换算出的公历时间
+template<TimeZone Zone>
+inline civil_time civil_in(int64_t sec, int32_t& offset) {
+  offset = Zone == TimeZone::UTC ? 0 : local_utc_offset(sec);
+  return civil_from_unix(sec + offset);
+}
+
+/// "00" ~ "99" 的两位数字表, 每次写两位
+inline constexpr auto digit_pairs = [] {
+  std::array<char, 200> table{};
+  for (int i = 0; i < 100; ++i) {
+    table[i * 2]     = static_cast<char>('0' + i / 10);
+    table[i * 2 + 1] = static_cast<char>('0' + i % 10);
+  }
+  return table;
+}();
+
+/// @brief 从 p 开始写入恰好 Width 位十进制数字(高位补 0), 返回写入结束的位置
+template<int Width>
+inline char* write_digits(char* p, uint32_t value) {
+  char* q = p + Width;
+  for (int i = 0; i + 1 < Width; i += 2) {
+    q -= 2;
+    std::memcpy(q, &digit_pairs[(value % 100) * 2], 2);
+    value /= 100;
+  }
+  if constexpr (Width % 2 == 1) { *--q = static_cast<char>('0' + value % 10); }
+  return p + Width;
+}
+
+/// @brief 写入 RFC 3339 形式的时区偏移 "+08:00"
+inline char* write_utc_offset(char* p, int32_t offset) {
+  *p++ = offset < 0 ? '-' : '+';
+  auto const abs = static_cast<uint32_t>(offset < 0 ? -offset : offset);
+  p    = write_digits<2>(p, abs / 3600);
+  *p++ = ':';
+  return write_digits<2>(p, abs / 60 % 60);
+}
+
 constexpr char             digits[10] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9'};
 constexpr std::string_view WDAY[7]    = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
 constexpr std::string_view YMON[12]   = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
@@ -359,10 +521,12 @@ inline void to_sec(char* buf, int day, char c) {
   to_int<2>(day, c, buf);
 }
 
-template<size_t Hour = 8, size_t N>
+/// @tparam Zone LOCAL 按本地时区(含夏令时)输出, UTC 输出格林尼治时间
+template<TimeZone Zone = TimeZone::LOCAL, size_t N>
 inline std::string_view get_local_time_str(char (&buf)[N], std::time_t t, std::string_view format) {
   static_assert(N >= 20, "wrong buf");
-  struct tm* loc_time = gmtime(&t);
+  int32_t          offset;
+  civil_time const civil = civil_in<Zone>(t, offset);
 
   char* p = buf;
 
@@ -371,30 +535,30 @@ inline std::string_view get_local_time_str(char (&buf)[N], std::time_t t, std::s
     char c = i + 2 < format.size() ? format[i + 2] : '0';
     i++;
     if (format[i] == 'Y') {
-      to_year(p, loc_time->tm_year + 1900, c);
+      to_year(p, civil.year, c);
       p += 5;
     } else if (format[i] == 'm') {
-      to_month(p, loc_time->tm_mon + 1, c);
+      to_month(p, civil.month, c);
       p += 3;
     } else if (format[i] == 'd') {
-      to_day(p, loc_time->tm_mday, c);
+      to_day(p, civil.day, c);
       p += 3;
     } else if (format[i] == 'H') {
-      to_hour(p, loc_time->tm_hour + Hour, c);
+      to_hour(p, civil.hour, c);
       p += 3;
     } else if (format[i] == 'M') {
-      to_min(p, loc_time->tm_min, c);
+      to_min(p, civil.minute, c);
       p += 3;
     } else if (format[i] == 'S') {
-      to_sec(p, loc_time->tm_sec, c);
+      to_sec(p, civil.second, c);
       p += 3;
     } else if (format[i] == 'a') {
-      memcpy(p, WDAY[loc_time->tm_wday].data(), 3);
+      memcpy(p, WDAY[civil.wday].data(), 3);
       p += 3;
       *p++ = c;
       *p++ = ' ';
     } else if (format[i] == 'b') {
-      memcpy(p, YMON[loc_time->tm_mon].data(), 3);
+      memcpy(p, YMON[civil.month - 1].data(), 3);
       p += 3;
       *p = c;
       p += 1;
@@ -446,7 +610,7 @@ inline std::string_view get_local_time_str() {
 template<size_t N>
 inline std::string_view get_gmt_time_str(char (&buf)[N], std::time_t t) {
   static_assert(N >= 29, "wrong buf");
-  auto   s    = time_util::get_local_time_str<0>(buf, t, "%a, %d %b %Y %H:%M:%S");
+  auto   s    = time_util::get_local_time_str<TimeZone::UTC>(buf, t, "%a, %d %b %Y %H:%M:%S");
   size_t size = s.size();
   memcpy(buf + size, " GMT", 4);
 
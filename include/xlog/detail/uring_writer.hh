@@ -0,0 +1,301 @@
+//
+// xlog / uring_writer.hh
+// Created by brian on 2024-07-26.
+//
+
+#ifndef XLOG_URING_WRITER_HH
+#define XLOG_URING_WRITER_HH
+
+#if defined(__linux__) and __has_include(<linux/io_uring.h> )
+  #define XLOG_HAS_IO_URING 1
+
+  #include <linux/io_uring.h>
+  #include <sys/mman.h>
+  #include <sys/syscall.h>
+  #include <unistd.h>
+
+  #include <algorithm>
+  #include <cerrno>
+  #include <cstdint>
+  #include <cstring>
+  #include <memory>
+  #include <string_view>
+  #include <system_error>
+  #include <vector>
+
+namespace xlog {
+namespace detail {
+/// @brief 不依赖 liburing 的最小 io_uring 封装, 只用到 write 和 fsync
+class io_uring_ring {
+public:
+  io_uring_ring() = default;
+
+  io_uring_ring(const io_uring_ring&)            = delete;
+  io_uring_ring& operator=(const io_uring_ring&) = delete;
+
+  ~io_uring_ring() {
+    if (sqes_) ::munmap(sqes_, sqesSize_);
+    if (cqPtr_ and cqPtr_ != sqPtr_) ::munmap(cqPtr_, cqSize_);
+    if (sqPtr_) ::munmap(sqPtr_, sqSize_);
+    if (ringFd_ >= 0) ::close(ringFd_);
+  }
+
+  /// @return 内核不支持或被禁用时返回 false, 调用方应退回普通 write
+  bool init(unsigned entries) {
+    io_uring_params params{};
+    ringFd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+    if (ringFd_ < 0) return false;
+
+    sqSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool const single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) sqSize_ = cqSize_ = (std::max)(sqSize_, cqSize_);
+
+    sqPtr_ = map(sqSize_, IORING_OFF_SQ_RING);
+    if (sqPtr_ == nullptr) return false;
+    cqPtr_ = single ? sqPtr_ : map(cqSize_, IORING_OFF_CQ_RING);
+    if (cqPtr_ == nullptr) return false;
+    sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_     = static_cast<io_uring_sqe*>(map(sqesSize_, IORING_OFF_SQES));
+    if (sqes_ == nullptr) return false;
+
+    auto* sq  = static_cast<char*>(sqPtr_);
+    auto* cq  = static_cast<char*>(cqPtr_);
+    sqHead_   = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sqTail_   = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sqMask_   = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sqArray_  = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    sqEntries_ = params.sq_entries;
+    cqHead_   = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cqTail_   = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cqMask_   = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_     = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
+  }
+
+  /// @brief 取一个空闲的提交项, 提交队列已满时返回 nullptr
+  io_uring_sqe* next() {
+    unsigned const head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    if (localTail_ - head >= sqEntries_) return nullptr;
+    io_uring_sqe* sqe = &sqes_[localTail_ & sqMask_];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqArray_[localTail_ & sqMask_] = localTail_ & sqMask_;
+    ++localTail_;
+    return sqe;
+  }
+
+  /// @brief 提交所有已准备好的提交项, minComplete > 0 时等待相应数量的完成事件
+  int submit(unsigned minComplete = 0) {
+    unsigned const tail    = __atomic_load_n(sqTail_, __ATOMIC_RELAXED);
+    unsigned const toSubmit = localTail_ - tail;
+    __atomic_store_n(sqTail_, localTail_, __ATOMIC_RELEASE);
+    for (;;) {
+      long rc = ::syscall(__NR_io_uring_enter, ringFd_, toSubmit, minComplete,
+                          minComplete ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+      if (rc >= 0 or errno != EINTR) return static_cast<int>(rc);
+    }
+  }
+
+  /// @brief 取出所有已完成的事件
+  template<typename Fn>
+  unsigned reap(Fn&& fn) {
+    unsigned       head  = __atomic_load_n(cqHead_, __ATOMIC_RELAXED);
+    unsigned const tail  = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    unsigned       count = 0;
+    for (; head != tail; ++head, ++count) { fn(cqes_[head & cqMask_]); }
+    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+    return count;
+  }
+
+private:
+  void* map(size_t size, off_t offset) const {
+    void* ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, offset);
+    return ptr == MAP_FAILED ? nullptr : ptr;
+  }
+
+  int           ringFd_    = -1;
+  void*         sqPtr_     = nullptr;
+  void*         cqPtr_     = nullptr;
+  size_t        sqSize_    = 0;
+  size_t        cqSize_    = 0;
+  io_uring_sqe* sqes_      = nullptr;
+  size_t        sqesSize_  = 0;
+  unsigned*     sqHead_    = nullptr;
+  unsigned*     sqTail_    = nullptr;
+  unsigned*     sqArray_   = nullptr;
+  unsigned      sqMask_    = 0;
+  unsigned      sqEntries_ = 0;
+  unsigned      localTail_ = 0;
+  unsigned*     cqHead_    = nullptr;
+  unsigned*     cqTail_    = nullptr;
+  unsigned      cqMask_    = 0;
+  io_uring_cqe* cqes_      = nullptr;
+};
+} // namespace detail
+
+/// @brief io_uring 异步写入: 多块缓冲区轮流填充, 填满后提交写请求即返回,
+/// 完成事件到达后回收缓冲区; 只有所有缓冲区都在途时才会等待
+/// @note 使用显式偏移写入, 因此文件不能以 O_APPEND 打开
+class uring_writer {
+  struct buffer {
+    std::unique_ptr<char[]> data;
+    size_t                  used     = 0;
+    size_t                  written  = 0; // 已确认写入的字节数(用于短写重提交)
+    uint64_t                offset   = 0;
+    bool                    inflight = false;
+  };
+
+  static constexpr uint64_t fsync_tag = ~uint64_t(0);
+
+public:
+  uring_writer(size_t bufferSize, size_t bufferCount, bool dataSync)
+      : bufferSize_((std::max)(bufferSize, size_t(4096)))
+      , dataSync_(dataSync)
+      , buffers_((std::clamp)(bufferCount, size_t(2), size_t(64))) {
+    for (auto& buf : buffers_) buf.data.reset(new char[bufferSize_]);
+  }
+
+  bool init() { return ring_.init(static_cast<unsigned>(buffers_.size() * 2 + 2)); }
+
+  /// @brief 关联一个新打开的文件, offset 为当前文件末尾
+  void attach(int fd, uint64_t offset) {
+    fd_       = fd;
+    offset_   = offset;
+    current_  = 0;
+    failed_   = false;
+  }
+
+  void append(std::string_view data) {
+    while (not data.empty()) {
+      buffer&      buf = buffers_[current_];
+      size_t const n   = (std::min)(data.size(), bufferSize_ - buf.used);
+      std::memcpy(buf.data.get() + buf.used, data.data(), n);
+      buf.used += n;
+      data.remove_prefix(n);
+      if (buf.used == bufferSize_) submitCurrent();
+    }
+  }
+
+  /// @brief 提交当前缓冲区(及可选的 fdatasync), 不等待完成
+  void flush() {
+    submitCurrent();
+    if (dataSync_ and fd_ >= 0) {
+      if (io_uring_sqe* sqe = nextSqe()) {
+        sqe->opcode      = IORING_OP_FSYNC;
+        sqe->fd          = fd_;
+        sqe->flags       = IOSQE_IO_DRAIN;
+        sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        sqe->user_data   = fsync_tag;
+        ring_.submit();
+        ++pending_;
+      }
+    }
+    reap();
+  }
+
+  /// @brief 提交剩余数据并等待所有请求完成, 关闭文件前调用
+  void drain() {
+    submitCurrent();
+    while (pending_ > 0) {
+      ring_.submit(1);
+      reap();
+    }
+  }
+
+  bool            failed() const { return failed_; }
+  std::error_code error() const { return error_; }
+
+private:
+  io_uring_sqe* nextSqe() {
+    io_uring_sqe* sqe = ring_.next();
+    while (sqe == nullptr) {
+      ring_.submit(1);
+      reap();
+      sqe = ring_.next();
+    }
+    return sqe;
+  }
+
+  void submitCurrent() {
+    buffer& buf = buffers_[current_];
+    if (buf.used == 0 or fd_ < 0) return;
+    buf.offset   = offset_;
+    buf.written  = 0;
+    buf.inflight = true;
+    offset_ += buf.used;
+    submitWrite(current_);
+    ring_.submit();
+
+    // 切换到下一块空闲缓冲区, 全部在途时等待完成事件
+    current_ = (current_ + 1) % buffers_.size();
+    reap();
+    while (buffers_[current_].inflight) {
+      ring_.submit(1);
+      reap();
+    }
+  }
+
+  void submitWrite(size_t index) {
+    buffer&       buf = buffers_[index];
+    io_uring_sqe* sqe = nextSqe();
+    sqe->opcode       = IORING_OP_WRITE;
+    sqe->fd           = fd_;
+    sqe->addr         = reinterpret_cast<uint64_t>(buf.data.get() + buf.written);
+    sqe->len          = static_cast<uint32_t>(buf.used - buf.written);
+    sqe->off          = buf.offset + buf.written;
+    sqe->user_data    = index;
+    ++pending_;
+  }
+
+  void reap() {
+    size_t retry[64];
+    size_t retries = 0;
+    ring_.reap([&](const io_uring_cqe& cqe) {
+      --pending_;
+      if (cqe.user_data == fsync_tag) {
+        if (cqe.res < 0) setError(-cqe.res);
+        return;
+      }
+      buffer& buf = buffers_[cqe.user_data];
+      if (cqe.res == -EINTR or cqe.res == -EAGAIN) {
+        retry[retries++] = cqe.user_data;
+        return;
+      }
+      if (cqe.res <= 0) {
+        // 写入 0 字节(如磁盘已满)时重试不会有进展, 与出错一样丢弃这个缓冲区
+        setError(cqe.res < 0 ? -cqe.res : EIO);
+        buf.written = buf.used;
+      } else {
+        buf.written += static_cast<size_t>(cqe.res);
+      }
+      if (buf.written < buf.used) {
+        retry[retries++] = cqe.user_data; // 短写, 提交剩余部分
+        return;
+      }
+      buf.used     = 0;
+      buf.inflight = false;
+    });
+    for (size_t i = 0; i < retries; ++i) submitWrite(retry[i]);
+    if (retries > 0) ring_.submit();
+  }
+
+  void setError(int err) {
+    failed_ = true;
+    error_  = std::error_code(err, std::generic_category());
+  }
+
+  detail::io_uring_ring ring_;
+  size_t const          bufferSize_;
+  bool const            dataSync_;
+  std::vector<buffer>   buffers_;
+  size_t                current_ = 0;
+  size_t                pending_ = 0;
+  int                   fd_      = -1;
+  uint64_t              offset_  = 0;
+  bool                  failed_  = false;
+  std::error_code       error_;
+};
+} // namespace xlog
+#endif
+
+#endif // XLOG_URING_WRITER_HH
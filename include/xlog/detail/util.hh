@@ -16,7 +16,6 @@ class Logger;
 
 namespace xlog::util {
 
-extern inline std::unordered_map<size_t, std::shared_ptr<xlog::ILogger>> allLoggers;
 extern std::unordered_map<size_t, std::string>         names;
 
 constexpr size_t custom_hash(const char* data, const size_t length) {
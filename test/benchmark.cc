@@ -59,18 +59,52 @@ void test_glog() {
 #endif
 }
 
-void test_easylog(std::string filename, int count, bool async) {
+void test_easylog(std::string filename, int count, bool async,
+                  size_t bufferSize = XLOG_FILE_BUFFER_SIZE, bool alwaysFlush = false) {
   std::error_code ec;
   std::filesystem::remove(filename, ec);
   if (ec) {
     std::cout << ec.message() << "\n";
   }
-  xlog::InstantiateFileLogger(xlog::Level::DEBUG, filename, async, false, -1);
+  xlog::InstantiateFileLogger(xlog::Level::DEBUG, filename, async, false, -1, 1,
+                              alwaysFlush, bufferSize);
   for (int i = 0; i < 10; i++) {
     ScopedTimer timer("xlog");
     for (int i = 0; i < count; i++)
       XLOG_INFO << "Hello logger: msg number " << i;
   }
+  xlog::flushLogs();
+}
+
+/// 各时钟模式下取一次时间戳以及异步记录一条日志的平均耗时
+void test_clock_modes(std::string filename, int count) {
+  struct mode_name {
+    xlog::ClockMode mode;
+    const char*     name;
+  };
+  constexpr mode_name modes[] = {{xlog::ClockMode::SYSTEM, "system"},
+                                 {xlog::ClockMode::COARSE, "coarse"},
+                                 {xlog::ClockMode::TSC, "tsc   "}};
+  std::error_code ec;
+  std::filesystem::remove(filename, ec);
+  xlog::InstantiateFileLogger(xlog::Level::DEBUG, filename, true, false, -1, 1);
+  for (auto const& m : modes) {
+    xlog::setLogClock(m.mode);
+    uint64_t stampNs = 0, recordNs = 0;
+    int64_t  sink    = 0;
+    {
+      ScopedTimer timer(m.name, stampNs);
+      for (int i = 0; i < count; i++) sink += xlog::detail::stamp_now(m.mode).value;
+    }
+    {
+      ScopedTimer timer(m.name, recordNs);
+      for (int i = 0; i < count; i++) XLOG_INFO << "Hello logger: msg number " << i;
+    }
+    xlog::flushLogs();
+    std::cout << m.name << " : " << double(stampNs) / count << " ns/stamp, " << double(recordNs) / count
+              << " ns/record" << (sink == 42 ? "\n\n" : "\n");
+  }
+  xlog::setLogClock(xlog::ClockMode::SYSTEM);
 }
 
 #ifdef HAVE_SPDLOG
@@ -132,6 +166,14 @@ int main() {
   test_glog();
   std::cout << "========test sync xlog===========\n";
   test_easylog("xlog.txt", count, /*async =*/false);
+  std::cout << "========test sync xlog, 4KB buffer===========\n";
+  test_easylog("xlog.txt", count, /*async =*/false, 4_KB);
+  std::cout << "========test sync xlog, flush every record===========\n";
+  test_easylog("xlog.txt", count, /*async =*/false, 64_KB, /*alwaysFlush =*/true);
   std::cout << "========test async xlog===========\n";
   test_easylog("async_xlog.txt", count, /*async =*/true);
+  std::cout << "========test async xlog, flush every batch===========\n";
+  test_easylog("async_xlog.txt", count, /*async =*/true, 64_KB, /*alwaysFlush =*/true);
+  std::cout << "========test async xlog, clock modes===========\n";
+  test_clock_modes("clock_xlog.txt", count);
 }
@@ -31,6 +31,8 @@ int main() {
 #if __has_include(<fmt/format.h> ) or __has_include(<format>)
   XLOGFMT(INFO, "{}", "你好世界");
   MXLOGFMT(WARN, "System", "{1}, {0}", "你好世界", "再见世界");
+  XLOGDFMT(INFO, "{} {}", "你好世界", 42);
+  MXLOGDFMT(WARN, "System", "{1}, {0}", "你好世界", "再见世界");
 #endif
   // std::this_thread::sleep_for(std::chrono::seconds(1));
   return 0;
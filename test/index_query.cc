@@ -0,0 +1,72 @@
+//
+// xlog / index_query.cc
+// Created by brian on 2024-08-14.
+//
+// 同一份日志带索引和不带索引时, 按时间范围挑出的行数应当相同
+#include "xlog/api.hh"
+#include "../tools/tool_util.hh"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace {
+/// 按 file_ranges 挑出的字节范围统计时间在 [from, to] 内的行数
+size_t count_in_range(const std::string& path, int64_t from, int64_t to) {
+  uint64_t                                   size;
+  std::vector<std::pair<uint64_t, uint64_t>> ranges;
+  if (not xlog::tools::file_ranges(path, from, to, size, ranges)) return 0;
+  xlog::tools::line_clock clock(false);
+  std::ifstream           in(path, std::ios::binary);
+  size_t                  lines = 0;
+  for (auto [begin, end] : ranges) {
+    std::string text(end - begin, '\0');
+    in.seekg(static_cast<std::streamoff>(begin));
+    in.read(text.data(), static_cast<std::streamsize>(text.size()));
+    size_t pos = 0;
+    while (pos < text.size()) {
+      size_t const nl   = text.find('\n', pos);
+      size_t const next = nl == std::string::npos ? text.size() : nl + 1;
+      auto         line = std::string_view(text).substr(pos, next - pos);
+      if (begin == 0 and pos == 0 and line.starts_with("\xEF\xBB\xBF")) line.remove_prefix(3);
+      int64_t t;
+      if (clock.parse(line, t) and t >= from and t <= to) ++lines;
+      pos = next;
+    }
+  }
+  return lines;
+}
+} // namespace
+
+int main() {
+  std::filesystem::remove("index_query.log");
+  std::filesystem::remove("index_query.log.idx");
+  xlog::InstantiateFileLogger(xlog::Level::TRACE, "index_query.log", true, false, 1024_MB);
+  xlog::setLogIndex(64 * 1024);
+  for (int i = 0; i < 200000; ++i) XLOG_INFO << "record " << i;
+  xlog::flushLogs();
+  std::filesystem::copy_file("index_query.log", "index_query.noidx.log",
+                             std::filesystem::copy_options::overwrite_existing);
+
+  // 用文件中实际出现的行首时间作为边界, 边界上的记录最容易被索引误删
+  std::vector<int64_t>    stamps;
+  xlog::tools::line_clock clock(false);
+  std::ifstream           in("index_query.log");
+  for (std::string line; std::getline(in, line);) {
+    if (line.starts_with("\xEF\xBB\xBF")) line.erase(0, 3);
+    if (int64_t t; clock.parse(line, t) and (stamps.empty() or stamps.back() != t)) stamps.push_back(t);
+  }
+
+  int failures = 0;
+  for (size_t i = 0; i + 1 < stamps.size(); i += (std::max)(size_t(1), stamps.size() / 8)) {
+    int64_t const from = stamps[i], to = stamps[i + (stamps.size() - i) / 2];
+    size_t const  indexed = count_in_range("index_query.log", from, to);
+    size_t const  scanned = count_in_range("index_query.noidx.log", from, to);
+    std::printf("[%lld, %lld] indexed %zu, full scan %zu %s\n", static_cast<long long>(from),
+                static_cast<long long>(to), indexed, scanned, indexed == scanned ? "ok" : "FAILED");
+    if (indexed != scanned) ++failures;
+  }
+  return failures == 0 and not stamps.empty() ? 0 : 1;
+}
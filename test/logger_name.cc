@@ -0,0 +1,34 @@
+//
+// xlog / logger_name.cc
+// Created by brian on 2024-08-14.
+//
+#include "xlog/api.hh"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+namespace {
+/// 文件中是否有一行同时包含 tag 和 message
+bool contains_line(const char* filename, std::string_view tag, std::string_view message) {
+  std::ifstream in(filename);
+  std::string   line;
+  while (std::getline(in, line)) {
+    if (line.find(tag) != std::string::npos and line.find(message) != std::string::npos) return true;
+  }
+  return false;
+}
+} // namespace
+
+int main() {
+  // 先通过不带名字的 api 函数创建, 日志宏第一次访问时更正为 "System"
+  xlog::InstantiateFileLogger<"System"_hash>(xlog::Level::TRACE, "logger_name.log", false, false, 100_MB);
+  xlog::setLogLevelTo<"System"_hash>(xlog::Level::TRACE);
+  MXLOG_INFO("System") << "named after first use";
+  xlog::flushLogs<"System"_hash>();
+
+  bool const ok = contains_line("logger_name.log", "[System]", "named after first use");
+  std::printf("[System] tag %s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -20,6 +20,7 @@ int main() {
   MXLOG_ERROR(systemLogger) << "你好世界" << 12.3;
   XLOGV(INFO, "%s", "你好世界");
   MXLOGV(WARN, systemLogger, "%s", "你好世界");
+  XLOG_INFO.kv("user", 42).kv("lat_us", 12.5) << "你好世界";
 #if __has_include(<fmt/format.h> ) or __has_include(<format>)
   XLOGFMT(INFO, "{}", "你好世界");
   MXLOGFMT(WARN, systemLogger, "{1}, {0}", "你好世界", "再见世界");
@@ -0,0 +1,36 @@
+//
+// xlog / overflow.cc
+// Created by brian on 2024-08-14.
+//
+#include "xlog/api.hh"
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+namespace {
+size_t count_lines(const char* filename) {
+  std::ifstream in(filename);
+  std::string   line;
+  size_t        lines = 0;
+  while (std::getline(in, line)) ++lines;
+  return lines;
+}
+} // namespace
+
+int main() {
+  std::remove("overflow.log");
+  xlog::InstantiateFileLogger(xlog::Level::TRACE, "overflow.log", true, false, 100_MB);
+  xlog::setQueueOverflow(10, xlog::OverflowPolicy::DROP_NEWEST);
+  xlog::stopAsyncLog();
+  // 写线程停止后同步写出, 不再占用队列容量, 一条都不应丢弃
+  for (int i = 0; i < 100; ++i) XLOG_INFO << "after stop " << i;
+  xlog::flushLogs();
+
+  size_t const lines   = count_lines("overflow.log");
+  auto const   dropped = xlog::queueOverflowStats().dropped();
+  bool const   ok      = lines == 100 and dropped == 0;
+  std::printf("after stop: %zu lines, %llu dropped %s\n", lines, static_cast<unsigned long long>(dropped),
+              ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
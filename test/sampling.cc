@@ -0,0 +1,84 @@
+//
+// xlog / sampling.cc
+// Created by brian on 2024-08-11.
+//
+#include "xlog/api.hh"
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+using namespace std::chrono_literals;
+
+namespace {
+int failures = 0;
+
+/// 被跳过的语句不求值 << 右侧的参数, 所以 ++admitted 的次数就是实际输出的条数
+void expect(const char* what, int admitted, int min, int max) {
+  bool const ok = admitted >= min and admitted <= max;
+  std::printf("%-36s admitted %4d, expected [%d, %d] %s\n", what, admitted, min, max, ok ? "ok" : "FAILED");
+  if (not ok) ++failures;
+}
+
+/// 用模拟的时钟每 step 调用一次, 共 calls 次, 返回放行的次数; 结果与机器负载无关
+template<typename Sampler, typename Arg>
+int simulate(Arg arg, std::chrono::milliseconds step, int calls) {
+  Sampler sampler;
+  int     admitted = 0;
+  for (int i = 0; i < calls; ++i) {
+    uint64_t suppressed = 0;
+    admitted += sampler.admit(arg, suppressed, std::chrono::nanoseconds(step * i).count());
+  }
+  return admitted;
+}
+
+/// 每毫秒调用一次 fn, 持续 duration; 返回实际经过的时间
+template<typename Fn>
+std::chrono::milliseconds repeat_for(std::chrono::milliseconds duration, Fn&& fn) {
+  auto const start = std::chrono::steady_clock::now();
+  auto const end   = start + duration;
+  while (std::chrono::steady_clock::now() < end) {
+    fn();
+    std::this_thread::sleep_for(1ms);
+  }
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+}
+} // namespace
+
+int main() {
+  using xlog::detail::every_t_sampler;
+  using xlog::detail::rate_limiter;
+  xlog::InstantiateFileLogger(xlog::Level::TRACE, "sampling.log", true, false);
+
+  // 时间相关的采样器先用模拟时钟精确检查
+  expect("every_t(100ms), 1ms x 350", simulate<every_t_sampler>(100ms, 1ms, 350), 4, 4);
+  // 一秒的突发: 前 111 次全部放行, 之后每 10ms 一次
+  expect("rate_limiter(100/s), 1ms x 500", simulate<rate_limiter>(100.0, 1ms, 500), 149, 149);
+  // 不足每秒一条时每 2 秒一条
+  expect("rate_limiter(0.5/s), 100ms x 25", simulate<rate_limiter>(0.5, 100ms, 25), 2, 2);
+  expect("rate_limiter(0/s), 1ms x 100", simulate<rate_limiter>(0.0, 1ms, 100), 0, 0);
+
+  int admitted = 0;
+  for (int i = 0; i < 100; ++i) XLOG_EVERY_N(INFO, 10) << "every 10th, call " << i << " #" << ++admitted;
+  expect("XLOG_EVERY_N(10) x 100", admitted, 10, 10);
+
+  admitted = 0;
+  for (int i = 0; i < 100; ++i) XLOG_FIRST_N(INFO, 5) << "first 5, call " << i << " #" << ++admitted;
+  expect("XLOG_FIRST_N(5) x 100", admitted, 5, 5);
+
+  admitted = 0;
+  for (int i = 0; i < 100; ++i) MXLOG_EVERY_N(INFO, "System", 25) << "System every 25th #" << ++admitted;
+  expect("MXLOG_EVERY_N(System, 25) x 100", admitted, 4, 4);
+
+  // 宏使用真实时钟, 按实际经过的时间给出上下界, 机器繁忙时也不会误报
+  admitted       = 0;
+  auto   elapsed = repeat_for(350ms, [&] { XLOG_EVERY_T(INFO, 100ms) << "every 100ms #" << ++admitted; });
+  expect("XLOG_EVERY_T(100ms) for 350ms", admitted, 1, static_cast<int>(elapsed / 100ms) + 1);
+
+  admitted = 0;
+  elapsed  = repeat_for(200ms, [&] { XLOG_RATE_LIMITED(INFO, 100) << "100/s #" << ++admitted; });
+  expect("XLOG_RATE_LIMITED(100) for 200ms", admitted, 1, 100 + static_cast<int>(elapsed / 10ms) + 1);
+
+  xlog::flushLogs();
+  return failures == 0 ? 0 : 1;
+}
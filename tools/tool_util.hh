@@ -0,0 +1,236 @@
+//
+// xlog / tool_util.hh
+// Created by brian on 2024-08-11.
+//
+// tools/ 下各个离线工具共用的部分: 命令行时间解析、行首时间解析、按索引挑选字节范围和只读映射
+
+#ifndef XLOG_TOOL_UTIL_HH
+#define XLOG_TOOL_UTIL_HH
+
+#include "xlog/detail/segment.hh"
+#include "xlog/detail/time_index.hh"
+#include "xlog/detail/time_util.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <unistd.h>
+#endif
+
+namespace xlog::tools {
+using namespace xlog::detail;
+
+constexpr inline int64_t nanos_per_second = 1'000'000'000;
+
+/// 把本地墙上时间(按 UTC 换算出的秒数)转换为 unix 秒数
+inline int64_t local_to_unix(int64_t wall) {
+  int64_t const guess = wall - time_util::utc_offset_cache::query(wall);
+  return wall - time_util::utc_offset_cache::query(guess);
+}
+
+/// 解析 ".123" 形式的小数部分, 返回纳秒; 没有小数部分时返回 0
+inline int64_t parse_fraction(std::string_view& text) {
+  if (text.empty() or text.front() != '.') return 0;
+  int64_t nanos = 0, scale = nanos_per_second;
+  size_t  i     = 1;
+  for (; i < text.size() and text[i] >= '0' and text[i] <= '9'; ++i) {
+    if (scale > 1) {
+      scale /= 10;
+      nanos += (text[i] - '0') * scale;
+    }
+  }
+  text.remove_prefix(i);
+  return nanos;
+}
+
+/// @brief 解析命令行中的时间
+inline bool parse_bound(std::string_view text, bool utc, int64_t& nanos) {
+  if (not text.empty() and text.find_first_not_of("0123456789") == std::string_view::npos) {
+    nanos = std::stoll(std::string(text)) * nanos_per_second;
+    return true;
+  }
+  if (text.ends_with("GMT")) {
+    auto [ok, t] = time_util::get_timestamp<time_format::http_format>(text);
+    nanos        = t * nanos_per_second;
+    return ok;
+  }
+  // 统一为 get_timestamp 接受的 "YYYY-MM-DDTHH:MM:SS.fffZ"
+  bool const  zulu = text.ends_with('Z');
+  std::string iso(text.substr(0, zulu ? text.size() - 1 : text.size()));
+  if (iso.size() > 10 and iso[10] == ' ') iso[10] = 'T';
+  std::string_view rest     = std::string_view(iso).substr((std::min)(iso.size(), size_t(19)));
+  int64_t const    fraction = parse_fraction(rest);
+  if (not rest.empty()) return false;
+  iso.resize((std::min)(iso.size(), size_t(19)));
+  iso.append(".0Z");
+  auto [ok, t] = time_util::get_timestamp<time_format::utc_format>(iso);
+  if (not ok) return false;
+  nanos = (zulu or utc ? t : local_to_unix(t)) * nanos_per_second + fraction;
+  return true;
+}
+
+inline uint32_t digits(const char* p, int n) {
+  uint32_t v = 0;
+  for (int i = 0; i < n; ++i) {
+    if (p[i] < '0' or p[i] > '9') return UINT32_MAX;
+    v = v * 10 + (p[i] - '0');
+  }
+  return v;
+}
+
+/// @brief 从行首取出记录时间, 支持默认行格式和 JSON 布局
+class line_clock {
+public:
+  explicit line_clock(bool utc)
+      : utc_(utc) {}
+
+  /// @return 行首不是时间时返回 false
+  bool parse(std::string_view line, int64_t& nanos) {
+    constexpr std::string_view json_prefix = R"({"time":")";
+    bool const                 json        = line.starts_with(json_prefix);
+    if (json) line.remove_prefix(json_prefix.size());
+    if (line.size() < 19 or line[4] != '-' or line[7] != '-' or line[13] != ':' or line[16] != ':') return false;
+
+    int64_t wall;
+    if (line.substr(0, 19) == lastText_) {
+      wall = lastWall_;
+    } else {
+      uint32_t const y = digits(line.data(), 4), mo = digits(line.data() + 5, 2), d = digits(line.data() + 8, 2);
+      uint32_t const h = digits(line.data() + 11, 2), mi = digits(line.data() + 14, 2), s = digits(line.data() + 17, 2);
+      if ((y | mo | d | h | mi | s) == UINT32_MAX or mo == 0 or mo > 12) return false;
+      wall = time_util::days_from_civil(y, mo, d) * 86400 + h * 3600 + mi * 60 + s;
+      lastText_.assign(line.data(), 19);
+      lastWall_ = wall;
+    }
+    line.remove_prefix(19);
+    int64_t const fraction = parse_fraction(line);
+
+    int64_t unix;
+    if (json) {
+      // JSON 布局自带时区: Z 或 +08:00
+      int64_t offset = 0;
+      if (line.size() >= 6 and (line[0] == '+' or line[0] == '-')) {
+        offset = (digits(line.data() + 1, 2) * 3600 + digits(line.data() + 4, 2) * 60) * (line[0] == '-' ? -1 : 1);
+      }
+      unix = wall - offset;
+    } else {
+      unix = utc_ ? wall : cachedLocal(wall);
+    }
+    nanos = unix * nanos_per_second + fraction;
+    return true;
+  }
+
+private:
+  int64_t cachedLocal(int64_t wall) {
+    if (wall != localWall_) {
+      localWall_ = wall;
+      localUnix_ = local_to_unix(wall);
+    }
+    return localUnix_;
+  }
+
+  bool        utc_;
+  std::string lastText_;
+  int64_t     lastWall_  = 0;
+  int64_t     localWall_ = INT64_MIN;
+  int64_t     localUnix_ = 0;
+};
+
+/// @brief 只读映射文件中的 [begin, end), 映射从页边界开始
+class mapped_range {
+public:
+  mapped_range(const std::string& path, uint64_t begin, uint64_t end) {
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    auto const page    = static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+    uint64_t   aligned = begin & ~(page - 1);
+    mapLen_            = end - aligned;
+    void* p            = ::mmap(nullptr, mapLen_, PROT_READ, MAP_PRIVATE, fd, static_cast<off_t>(aligned));
+    ::close(fd);
+    if (p == MAP_FAILED) return;
+    ::madvise(p, mapLen_, MADV_SEQUENTIAL);
+    map_  = p;
+    view_ = {static_cast<const char*>(p) + (begin - aligned), end - begin};
+#else
+    std::FILE* in = std::fopen(path.c_str(), "rb");
+    if (in == nullptr) return;
+    buf_.resize(end - begin);
+    _fseeki64(in, static_cast<int64_t>(begin), SEEK_SET);
+    buf_.resize(std::fread(buf_.data(), 1, buf_.size(), in));
+    std::fclose(in);
+    view_ = buf_;
+#endif
+  }
+
+  ~mapped_range() {
+#ifndef _WIN32
+    if (map_) ::munmap(map_, mapLen_);
+#endif
+  }
+
+  mapped_range(const mapped_range&)            = delete;
+  mapped_range& operator=(const mapped_range&) = delete;
+
+  std::string_view view() const { return view_; }
+
+private:
+  std::string_view view_;
+#ifndef _WIN32
+  void*  map_    = nullptr;
+  size_t mapLen_ = 0;
+#else
+  std::string buf_;
+#endif
+};
+
+/// @brief 文件中需要读取的字节范围: 有索引时取与 [from, to] 相交的部分和索引尚未覆盖的末尾, 否则是整个文件.
+/// 索引记的是精确到纳秒的时间, 行首的时间却按布局截断(默认到毫秒, 最粗到秒), 截断后等于 to 的记录
+/// 实际时间可能略晚于 to, 所以按索引挑选时把 to 放宽一秒, 结果与不用索引时一致
+/// @return 文件无法读取时返回 false
+inline bool file_ranges(const std::string& path, int64_t from, int64_t to, uint64_t& size,
+                        std::vector<std::pair<uint64_t, uint64_t>>& ranges) {
+  std::error_code ec;
+  size = std::filesystem::file_size(path, ec);
+  if (ec) return false;
+  ranges.clear();
+  std::vector<index_entry> entries;
+  if (read_index(path + std::string(index_suffix), entries)) {
+    int64_t const widened = to > INT64_MAX - nanos_per_second ? INT64_MAX : to + nanos_per_second - 1;
+    ranges                = index_ranges(entries, from, widened);
+    // 索引中还没有记录的末尾部分
+    uint64_t const indexed = entries.empty() ? 0 : entries.back().offset + entries.back().length;
+    if (indexed < size) {
+      if (not ranges.empty() and ranges.back().second == indexed) {
+        ranges.back().second = size;
+      } else {
+        ranges.emplace_back(indexed, size);
+      }
+    }
+  } else if (size > 0) {
+    ranges.emplace_back(0, size);
+  }
+  for (auto& range : ranges) range.second = (std::min)(range.second, size);
+  return true;
+}
+
+/// 命令行中的索引文件和压缩过的段不是文本日志
+inline bool skipped(std::string_view path) {
+  if (path.ends_with(index_suffix)) return true;
+  for (auto suffix : compressed_suffixes) {
+    if (path.ends_with(suffix)) return true;
+  }
+  return false;
+}
+} // namespace xlog::tools
+
+#endif // XLOG_TOOL_UTIL_HH
@@ -0,0 +1,251 @@
+//
+// xlog / xlog_decode.cc
+// Created by brian on 2024-08-10.
+//
+// 把 setLogBinary 写出的二进制日志还原为文本, 行格式与 Sink 默认的 XLOG_DEFAULT_PATTERN 相同.
+// 用法: xlog_decode [--utc] [--json] [file ...]
+//   按参数顺序解码各个文件(滚动出的段各自带有文件头和字典, 可以任意挑选、按时间顺序排列);
+//   没有文件或文件名为 "-" 时从 stdin 流式读取, 例如 zcat app.3.log.gz | xlog_decode
+
+#include "xlog/detail/binlog.hh"
+#include "xlog/detail/json.hh"
+#include "xlog/detail/pattern.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+using namespace xlog;
+using namespace xlog::detail;
+
+/// 解码器持有调用点描述符引用的字符串
+struct site_entry {
+  std::string file;
+  std::string function;
+  std::string location;
+  std::string prefix;
+  call_site   site;
+};
+
+class decoder {
+public:
+  explicit decoder(const line_layout* layout, const char* source)
+      : layout_(layout),
+        source_(source) {}
+
+  /// @brief 解码 data 中完整的帧, 不完整的帧留给下一次调用
+  /// @param eof 之后不会再有数据, 不完整的帧视为文件被截断
+  /// @return 已经消费的字节数
+  size_t feed(std::string_view data, bool eof) {
+    const char* p   = data.data();
+    const char* end = p + data.size();
+    while (p < end) {
+      if (static_cast<size_t>(end - p) >= binlog_magic.size() and
+          std::memcmp(p, binlog_magic.data(), binlog_magic.size()) == 0) {
+        reset();
+        p += binlog_magic.size();
+        continue;
+      }
+      if (*p == binlog_magic[0] and not eof and static_cast<size_t>(end - p) < binlog_magic.size()) {
+        // 可能是被读取边界截断的文件头
+        break;
+      }
+      if (not synced_) {
+        // 跳过文件头之前的内容(例如切换格式前写下的文本), 保留可能是半个文件头的末尾
+        auto const pos = data.find(binlog_magic, p - data.data());
+        if (pos != std::string_view::npos) {
+          p = data.data() + pos;
+          continue;
+        }
+        if (eof) return data.size();
+        return std::max(p, end - (binlog_magic.size() - 1)) - data.data();
+      }
+      const char*  q      = p;
+      status const result = frame(q, end);
+      if (result == status::ok) {
+        p = q;
+      } else if (result == status::more) {
+        if (eof) {
+          std::fprintf(stderr, "xlog_decode: %s: truncated frame at the end\n", source_);
+          return data.size();
+        }
+        break;
+      } else {
+        std::fprintf(stderr, "xlog_decode: %s: corrupted frame, skipping to the next header\n", source_);
+        synced_ = false;
+        ++p;
+      }
+    }
+    flush();
+    return p - data.data();
+  }
+
+  void flush() {
+    std::fwrite(out_.data(), 1, out_.size(), stdout);
+    out_.clear();
+  }
+
+private:
+  enum class status { ok, more, bad };
+
+  void reset() {
+    sites_.clear();
+    loggers_.clear();
+    formats_.clear();
+    lastNanos_ = 0;
+    synced_    = true;
+  }
+
+  /// @brief 解析 p 处的一帧, 成功时 p 移到帧尾
+  status frame(const char*& p, const char* end) {
+    const char* q   = p + 1;
+    auto const  tag = static_cast<binlog_frame>(*p);
+    uint64_t    id;
+    if (not read_varint(q, end, id)) return status::more;
+
+    switch (tag) {
+    case binlog_frame::site: {
+      if (q == end) return status::more;
+      auto const       level = static_cast<Level>(static_cast<uint8_t>(*q++));
+      uint64_t         line;
+      std::string_view file, function;
+      if (not read_varint(q, end, line) or not read_bytes(q, end, file) or not read_bytes(q, end, function)) {
+        return status::more;
+      }
+      if (id != sites_.size() + 1 or level < Level::TRACE or level > Level::FATAL) return status::bad;
+      addSite(level, static_cast<uint32_t>(line), file, function);
+      break;
+    }
+    case binlog_frame::logger:
+    case binlog_frame::format: {
+      std::string_view str;
+      if (not read_bytes(q, end, str)) return status::more;
+      auto& dict = tag == binlog_frame::logger ? loggers_ : formats_;
+      if (id != dict.size() + 1) return status::bad;
+      dict.emplace_back(str);
+      break;
+    }
+    case binlog_frame::record: {
+      uint64_t         logger, delta, tid, format;
+      std::string_view payload, fields;
+      if (not read_varint(q, end, logger) or not read_varint(q, end, delta) or not read_varint(q, end, tid) or
+          not read_varint(q, end, format) or not read_bytes(q, end, payload) or not read_bytes(q, end, fields)) {
+        return status::more;
+      }
+      if (id == 0 or id > sites_.size() or logger == 0 or logger > loggers_.size() or format > formats_.size()) {
+        return status::bad;
+      }
+      lastNanos_ += unzigzag(delta);
+      emit(sites_[id - 1].site, loggers_[logger - 1], static_cast<uint32_t>(tid),
+           format ? std::string_view(formats_[format - 1]) : std::string_view{}, payload, fields);
+      break;
+    }
+    default: return status::bad;
+    }
+    p = q;
+    return status::ok;
+  }
+
+  void addSite(Level level, uint32_t line, std::string_view file, std::string_view function) {
+    site_entry& entry = sites_.emplace_back();
+    entry.file        = file;
+    entry.function    = function;
+    entry.location    = entry.file;
+    // 内部记录(行号为 0)没有 "file:line" 前缀
+    if (line != 0) {
+      entry.location.append(":").append(std::to_string(line));
+      entry.prefix.append("[").append(entry.location).append("] ");
+    }
+    entry.site = {entry.file, entry.location, entry.prefix, entry.function, line, level, 0};
+  }
+
+  void emit(const call_site& site, std::string_view logger, uint32_t tid, std::string_view format,
+            std::string_view payload, std::string_view fields) {
+    auto const stamp = std::chrono::duration_cast<std::chrono::system_clock::duration>(
+        std::chrono::nanoseconds(lastNanos_));
+    record_t record(log_stamp{stamp.count(), false}, &site);
+    record.setLoggerName(logger);
+    record.restore(tid, fields);
+    if (format.empty()) {
+      record << payload;
+    } else {
+      text_.clear();
+      render_deferred(text_, format, payload);
+      record << std::string_view(text_);
+    }
+    layout_->plain(out_, record);
+    if (out_.size() >= (1 << 16)) flush();
+  }
+
+  const line_layout*      layout_;
+  const char*             source_;
+  std::deque<site_entry>  sites_;
+  std::deque<std::string> loggers_;
+  std::deque<std::string> formats_;
+  int64_t                 lastNanos_ = 0;
+  bool                    synced_    = false;
+  std::string             text_;
+  std::string             out_;
+};
+
+bool decode(const char* path, const line_layout* layout) {
+  bool const  useStdin = std::strcmp(path, "-") == 0;
+  std::FILE*  in       = useStdin ? stdin : std::fopen(path, "rb");
+  if (in == nullptr) {
+    std::fprintf(stderr, "xlog_decode: cannot open %s: %s\n", path, std::strerror(errno));
+    return false;
+  }
+  decoder     dec(layout, useStdin ? "<stdin>" : path);
+  std::string buf;
+  size_t      size = 0;
+  bool        eof  = false;
+  while (not eof) {
+    buf.resize(size + (1 << 20));
+    size_t const n = std::fread(buf.data() + size, 1, buf.size() - size, in);
+    size += n;
+    eof = n == 0;
+    size_t const used = dec.feed(std::string_view(buf.data(), size), eof);
+    std::memmove(buf.data(), buf.data() + used, size - used);
+    size -= used;
+  }
+  dec.flush();
+  if (not useStdin) std::fclose(in);
+  return true;
+}
+} // namespace
+
+int main(int argc, char** argv) {
+  bool                     utc  = false;
+  bool                     json = false;
+  std::vector<const char*> files;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view const arg = argv[i];
+    if (arg == "--utc") {
+      utc = true;
+    } else if (arg == "--json") {
+      json = true;
+    } else if (arg == "-h" or arg == "--help") {
+      std::printf("usage: %s [--utc] [--json] [file ...]\n"
+                  "decode xlog binary logs to text; reads stdin when no file or '-' is given\n",
+                  argv[0]);
+      return 0;
+    } else {
+      files.push_back(argv[i]);
+    }
+  }
+  if (files.empty()) files.push_back("-");
+
+  const line_layout* layout = json  ? (utc ? &json_layout<TimeZone::UTC> : &json_layout<TimeZone::LOCAL>)
+                              : utc ? &layout_of<XLOG_DEFAULT_PATTERN, TimeZone::UTC>
+                                    : &layout_of<XLOG_DEFAULT_PATTERN>;
+  bool ok = true;
+  for (const char* file : files) ok = decode(file, layout) and ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,479 @@
+//
+// xlog / xlog_grep.cc
+// Created by brian on 2024-08-11.
+//
+// 按字段过滤默认行格式(XLOG_DEFAULT_PATTERN)写出的文本日志.
+// 用法: xlog_grep [-e 文本] [--level 等级] [--logger 名字] [--thread 线程ID] [--file 源文件]
+//                 [--from 时间] [--to 时间] [--utc] [-c] [-j 线程数] file ...
+//   -e 在消息(含多行日志的后续行和字段)中查找子串, --level 为最低等级, --file 匹配源文件名或路径末尾,
+//   时间的写法与 xlog_query 相同; 多行日志作为一条记录整体输出.
+//   文件按记录边界切成约 64MB 的段, 各段由多个线程扫描, 结果按参数顺序边扫描边输出;
+//   有 .idx 索引时只读取与时间范围相交的部分
+
+#include "tool_util.hh"
+
+#include "xlog/detail/binlog.hh"
+#include "xlog/detail/pattern.hh"
+
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <charconv>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) or defined(_M_X64) or (defined(_M_IX86_FP) and _M_IX86_FP >= 2)
+  #include <emmintrin.h>
+  #define XLOG_GREP_SSE2 1
+  #if (defined(__GNUC__) or defined(__clang__)) and (defined(__x86_64__) or defined(__i386__))
+    #include <immintrin.h>
+    #define XLOG_GREP_AVX2 1
+  #endif
+#elif defined(__aarch64__) and defined(__ARM_NEON)
+  #include <arm_neon.h>
+  #define XLOG_GREP_NEON 1
+#endif
+
+namespace {
+using namespace xlog;
+using namespace xlog::tools;
+
+/// @brief 返回 [p, end) 中第一个满足 p[0] == a 且 p[gap] == b 的位置, 没有时返回 end.
+/// gap 为 0 时就是查找单个字节; 查找子串时 a、b 是首尾两个字节, 命中后再比较中间部分
+const char* find_pair_scalar(const char* p, const char* end, char a, char b, size_t gap) {
+  for (; static_cast<size_t>(end - p) > gap; ++p) {
+    if (p[0] == a and p[gap] == b) return p;
+  }
+  return end;
+}
+
+#if defined(XLOG_GREP_AVX2)
+__attribute__((target("avx2"))) const char* find_pair_avx2(const char* p, const char* end, char a, char b,
+                                                             size_t gap) {
+  __m256i const va = _mm256_set1_epi8(a);
+  __m256i const vb = _mm256_set1_epi8(b);
+  for (; static_cast<size_t>(end - p) >= gap + 32; p += 32) {
+    __m256i const x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    __m256i const y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + gap));
+    auto const    m = static_cast<unsigned>(
+        _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(x, va), _mm256_cmpeq_epi8(y, vb))));
+    if (m) return p + std::countr_zero(m);
+  }
+  return find_pair_scalar(p, end, a, b, gap);
+}
+#endif
+
+#if defined(XLOG_GREP_SSE2)
+const char* find_pair_sse2(const char* p, const char* end, char a, char b, size_t gap) {
+  __m128i const va = _mm_set1_epi8(a);
+  __m128i const vb = _mm_set1_epi8(b);
+  for (; static_cast<size_t>(end - p) >= gap + 16; p += 16) {
+    __m128i const x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i const y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + gap));
+    auto const m = static_cast<unsigned>(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(x, va), _mm_cmpeq_epi8(y, vb))));
+    if (m) return p + std::countr_zero(m);
+  }
+  return find_pair_scalar(p, end, a, b, gap);
+}
+#elif defined(XLOG_GREP_NEON)
+const char* find_pair_neon(const char* p, const char* end, char a, char b, size_t gap) {
+  uint8x16_t const va = vdupq_n_u8(static_cast<uint8_t>(a));
+  uint8x16_t const vb = vdupq_n_u8(static_cast<uint8_t>(b));
+  for (; static_cast<size_t>(end - p) >= gap + 16; p += 16) {
+    uint8x16_t const x = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+    uint8x16_t const y = vld1q_u8(reinterpret_cast<const uint8_t*>(p + gap));
+    // 每个字节压成 4 位, 得到 64 位掩码
+    uint8x8_t const  m = vshrn_n_u16(vreinterpretq_u16_u8(vandq_u8(vceqq_u8(x, va), vceqq_u8(y, vb))), 4);
+    if (uint64_t const bits = vget_lane_u64(vreinterpret_u64_u8(m), 0)) return p + (std::countr_zero(bits) >> 2);
+  }
+  return find_pair_scalar(p, end, a, b, gap);
+}
+#endif
+
+using find_pair_fn = const char* (*)(const char*, const char*, char, char, size_t);
+
+/// 启动时按 CPU 选择一次实现
+find_pair_fn const find_pair = [] {
+#if defined(XLOG_GREP_AVX2)
+  if (__builtin_cpu_supports("avx2")) return &find_pair_avx2;
+#endif
+#if defined(XLOG_GREP_SSE2)
+  return &find_pair_sse2;
+#elif defined(XLOG_GREP_NEON)
+  return &find_pair_neon;
+#else
+  return &find_pair_scalar;
+#endif
+}();
+
+const char* find_newline(const char* p, const char* end) { return find_pair(p, end, '\n', '\n', 0); }
+
+/// @brief 在 [p, end) 中查找 needle
+const char* find_text(const char* p, const char* end, std::string_view needle) {
+  size_t const gap = needle.size() - 1;
+  while (true) {
+    p = find_pair(p, end, needle.front(), needle.back(), gap);
+    if (p == end or std::memcmp(p + 1, needle.data() + 1, gap) == 0) return p;
+    ++p;
+  }
+}
+
+/// 行首是否是 "YYYY-MM-DD HH:MM:SS.mmm "
+bool is_header(const char* p, const char* end) {
+  return end - p >= 24 and p[4] == '-' and p[7] == '-' and p[10] == ' ' and p[13] == ':' and p[16] == ':' and
+         p[19] == '.' and p[23] == ' ' and static_cast<unsigned>(p[0] - '0') < 10;
+}
+
+/// @brief 默认行格式的一条记录: "时间 等级 [logger] [线程] [文件:行] 消息 字段", 消息可以跨行
+struct log_line {
+  std::string_view time;
+  Level            level = Level::NONE;
+  std::string_view logger;
+  uint32_t         thread = 0;
+  std::string_view file;
+  std::string_view message; // 到记录末尾
+};
+
+bool parse_line(std::string_view record, log_line& out) {
+  out.time = record.substr(0, 23);
+  record.remove_prefix(24);
+  // %l 补齐到 6 个字符
+  if (record.size() < 7) return false;
+  out.level = Level::NONE;
+  for (auto level : {Level::TRACE, Level::DEBUG, Level::INFO, Level::WARN, Level::ERROR, Level::FATAL}) {
+    if (record.starts_with(helper::LevelStr(level))) out.level = level;
+  }
+  if (out.level == Level::NONE or record[6] != '[') return false;
+  record.remove_prefix(7);
+
+  size_t const name = record.find("] [");
+  if (name == std::string_view::npos) return false;
+  out.logger = record.substr(0, name);
+  record.remove_prefix(name + 3);
+
+  auto const [tid, ec] = std::from_chars(record.data(), record.data() + record.size(), out.thread);
+  if (ec != std::errc{} or tid + 1 >= record.data() + record.size() or tid[0] != ']' or tid[1] != ' ') return false;
+  record.remove_prefix(tid + 2 - record.data());
+
+  // "[文件:行] ", 内部记录没有这一段
+  out.file = {};
+  if (record.starts_with('[')) {
+    size_t const close = record.find("] ");
+    size_t const colon = record.substr(0, close).rfind(':');
+    if (close != std::string_view::npos and colon != std::string_view::npos and colon + 1 < close and
+        record.substr(colon + 1, close - colon - 1).find_first_not_of("0123456789") == std::string_view::npos) {
+      out.file = record.substr(1, colon - 1);
+      record.remove_prefix(close + 2);
+    }
+  }
+  out.message = record;
+  return true;
+}
+
+struct grep_options {
+  std::string_view text;
+  Level            level = Level::TRACE;
+  std::string_view logger;
+  std::optional<uint32_t> thread;
+  std::string_view file;
+  int64_t          from  = INT64_MIN;
+  int64_t          to    = INT64_MAX;
+  bool             timed = false;
+  bool             utc   = false;
+  bool             count = false;
+};
+
+/// @brief 一个文件的输出: 扫描线程按块追加, 主线程按参数顺序取出写到 stdout.
+/// 积压的块达到上限时扫描线程等待, 排在后面的文件不会把全部结果攒在内存里
+class output_channel {
+public:
+  static constexpr size_t chunk_size = 1 << 20;
+  static constexpr size_t max_chunks = 4;
+
+  void push(std::string&& chunk) {
+    std::unique_lock lock(mtx_);
+    cnd_.wait(lock, [this] { return chunks_.size() < max_chunks; });
+    chunks_.push_back(std::move(chunk));
+    cnd_.notify_all();
+  }
+
+  void close() {
+    std::lock_guard guard(mtx_);
+    closed_ = true;
+    cnd_.notify_all();
+  }
+
+  /// @return 已关闭且取完时返回 false
+  bool pop(std::string& chunk) {
+    std::unique_lock lock(mtx_);
+    cnd_.wait(lock, [this] { return closed_ or not chunks_.empty(); });
+    if (chunks_.empty()) return false;
+    chunk = std::move(chunks_.front());
+    chunks_.pop_front();
+    cnd_.notify_all();
+    return true;
+  }
+
+private:
+  std::mutex              mtx_;
+  std::condition_variable cnd_;
+  std::deque<std::string> chunks_;
+  bool                    closed_ = false;
+};
+
+class grepper {
+public:
+  grepper(const grep_options& opts, output_channel& output)
+      : opts_(opts),
+        output_(output),
+        clock_(opts.utc) {}
+
+  /// @brief 交出缓冲中剩余的输出
+  /// @return 命中的记录数
+  uint64_t finish() {
+    if (not out_.empty()) output_.push(std::move(out_));
+    return records_;
+  }
+
+  /// @brief 扫描一段完整的记录
+  void scan(const char* begin, const char* end) {
+    if (end - begin >= 3 and std::memcmp(begin, "\xEF\xBB\xBF", 3) == 0) begin += 3;
+    begin_ = begin;
+    end_   = end;
+    if (opts_.text.empty()) {
+      for (const char* p = begin; p < end;) {
+        const char* next = recordEnd(p);
+        match(p, next);
+        p = next;
+      }
+      return;
+    }
+    // 先在整段中查找子串, 再确定命中所在的记录
+    for (const char* p = begin; p < end;) {
+      const char* hit = find_text(p, end, opts_.text);
+      if (hit == end) break;
+      const char* start = recordStart(hit);
+      const char* next  = recordEnd(hit);
+      match(start, next);
+      p = next;
+    }
+  }
+
+private:
+  /// 包含 p 的记录的下一条记录的开头
+  const char* recordEnd(const char* p) const {
+    while (true) {
+      p = find_newline(p, end_);
+      if (p == end_) return end_;
+      ++p;
+      if (p == end_ or is_header(p, end_)) return p;
+    }
+  }
+
+  /// 包含 p 的记录的开头, 向前逐行查找
+  const char* recordStart(const char* p) const {
+    while (true) {
+      while (p > begin_ and p[-1] != '\n') --p;
+      if (p == begin_ or is_header(p, end_)) return p;
+      --p;
+    }
+  }
+
+  void match(const char* begin, const char* end) {
+    log_line line;
+    if (not is_header(begin, end) or not parse_line({begin, static_cast<size_t>(end - begin)}, line)) return;
+    if (line.level < opts_.level) return;
+    if (not opts_.logger.empty() and line.logger != opts_.logger) return;
+    if (opts_.thread and line.thread != *opts_.thread) return;
+    if (not opts_.file.empty() and not (line.file == opts_.file or (line.file.ends_with(opts_.file) and
+                                                                     line.file[line.file.size() - opts_.file.size() - 1] == '/'))) {
+      return;
+    }
+    if (opts_.timed) {
+      int64_t t;
+      if (not clock_.parse(line.time, t) or t < opts_.from or t > opts_.to) return;
+    }
+    if (not opts_.text.empty()) {
+      const char* msgEnd = line.message.data() + line.message.size();
+      if (find_text(line.message.data(), msgEnd, opts_.text) == msgEnd) return;
+    }
+    ++records_;
+    if (not opts_.count) {
+      out_.append(begin, end);
+      if (end[-1] != '\n') out_.push_back('\n');
+      if (out_.size() >= output_channel::chunk_size) {
+        output_.push(std::move(out_));
+        out_ = std::string();
+      }
+    }
+  }
+
+  const grep_options& opts_;
+  output_channel&     output_;
+  std::string         out_;
+  uint64_t            records_ = 0;
+  line_clock          clock_;
+  const char*         begin_ = nullptr;
+  const char*         end_   = nullptr;
+};
+
+/// 一个线程扫描的单位: 文件中从记录开头到记录开头的一段
+struct piece {
+  const std::string* path;
+  uint64_t           begin;
+  uint64_t           end;
+};
+
+/// 大文件切段的目标长度, 以及在切点之后查找记录开头的窗口
+constexpr uint64_t piece_size   = 64ull << 20;
+constexpr uint64_t split_window = 1 << 20;
+
+/// @brief 把文件中要读取的字节范围切成段追加到 pieces: 超过 piece_size 的范围在切点之后的第一个记录开头处切开,
+/// 窗口内找不到记录开头(超长的多行日志)时不在这里切
+/// @return 文件无法读取或是二进制日志时返回 false
+bool plan_file(const std::string& path, const grep_options& opts, std::vector<piece>& pieces) {
+  uint64_t                                   size;
+  std::vector<std::pair<uint64_t, uint64_t>> ranges;
+  if (not file_ranges(path, opts.from, opts.to, size, ranges)) {
+    std::fprintf(stderr, "xlog_grep: cannot open %s\n", path.c_str());
+    return false;
+  }
+  if (size >= detail::binlog_magic.size() and
+      mapped_range(path, 0, detail::binlog_magic.size()).view() == detail::binlog_magic) {
+    std::fprintf(stderr, "xlog_grep: %s is a binary log, decode it with xlog_decode first\n", path.c_str());
+    return false;
+  }
+  for (auto [begin, end] : ranges) {
+    if (begin >= end) continue;
+    uint64_t start = begin;
+    for (uint64_t cut = begin + piece_size; cut + piece_size / 2 < end; cut += piece_size) {
+      if (cut <= start) continue;
+      mapped_range const     window(path, cut - 1, (std::min)(end, cut + split_window));
+      std::string_view const text = window.view();
+      const char* const      last = text.data() + text.size();
+      // 从切点前一个字节开始找换行, 切点恰好是行首时也能找到
+      for (const char* p = find_newline(text.data(), last); p != last; p = find_newline(p, last)) {
+        if (is_header(++p, last)) {
+          uint64_t const at = cut - 1 + static_cast<uint64_t>(p - text.data());
+          pieces.push_back({&path, start, at});
+          start = at;
+          break;
+        }
+      }
+    }
+    pieces.push_back({&path, start, end});
+  }
+  return true;
+}
+
+/// @brief 扫描一段, 命中的记录按块交给 output, 结束时关闭它
+/// @return 命中的记录数
+uint64_t grep_piece(piece part, const grep_options& opts, output_channel& output) {
+  grepper                scanner(opts, output);
+  mapped_range const     range(*part.path, part.begin, part.end);
+  std::string_view const text = range.view();
+  scanner.scan(text.data(), text.data() + text.size());
+  uint64_t const records = scanner.finish();
+  output.close();
+  return records;
+}
+
+std::optional<Level> parse_level(std::string_view name) {
+  for (auto level : {Level::TRACE, Level::DEBUG, Level::INFO, Level::WARN, Level::ERROR, Level::FATAL}) {
+    std::string_view str = helper::LevelStr(level);
+    str                  = str.substr(0, str.find(' '));
+    if (name.size() == str.size() and
+        std::equal(name.begin(), name.end(), str.begin(), [](char x, char y) { return std::toupper(x) == y; })) {
+      return level;
+    }
+  }
+  return std::nullopt;
+}
+} // namespace
+
+int main(int argc, char** argv) {
+  grep_options             opts;
+  std::vector<std::string> files;
+  std::string_view         fromArg, toArg;
+  unsigned                 jobs = std::max(1u, std::thread::hardware_concurrency());
+  for (int i = 1; i < argc; ++i) {
+    std::string_view const arg   = argv[i];
+    bool const             value = i + 1 < argc;
+    if (arg == "-e" and value) {
+      opts.text = argv[++i];
+    } else if (arg == "--level" and value) {
+      auto const level = parse_level(argv[++i]);
+      if (not level) {
+        std::fprintf(stderr, "xlog_grep: unknown level %s\n", argv[i]);
+        return 2;
+      }
+      opts.level = *level;
+    } else if (arg == "--logger" and value) {
+      opts.logger = argv[++i];
+    } else if (arg == "--thread" and value) {
+      opts.thread = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+    } else if (arg == "--file" and value) {
+      opts.file = argv[++i];
+    } else if ((arg == "--from" or arg == "--to") and value) {
+      (arg == "--from" ? fromArg : toArg) = argv[++i];
+    } else if (arg == "-j" and value) {
+      jobs = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--utc") {
+      opts.utc = true;
+    } else if (arg == "-c") {
+      opts.count = true;
+    } else if (arg == "-h" or arg == "--help") {
+      std::printf("usage: %s [-e TEXT] [--level LEVEL] [--logger NAME] [--thread TID] [--file SOURCE]\n"
+                  "       [--from TIME] [--to TIME] [--utc] [-c] [-j JOBS] file ...\n"
+                  "print xlog records matching all given filters; -c prints the number of matches only\n",
+                  argv[0]);
+      return 0;
+    } else if (not skipped(arg)) {
+      files.emplace_back(arg);
+    }
+  }
+  if ((not fromArg.empty() and not parse_bound(fromArg, opts.utc, opts.from)) or
+      (not toArg.empty() and not parse_bound(toArg, opts.utc, opts.to))) {
+    std::fprintf(stderr, "xlog_grep: cannot parse time bound\n");
+    return 2;
+  }
+  opts.timed = not fromArg.empty() or not toArg.empty();
+  if (files.empty()) {
+    std::fprintf(stderr, "xlog_grep: no log files given\n");
+    return 2;
+  }
+
+  std::vector<piece> pieces;
+  for (auto const& file : files) plan_file(file, opts, pieces);
+
+  // 最多 jobs 段同时扫描; 排在最前的一段边扫描边输出, 其余的最多积压几块
+  struct job {
+    std::unique_ptr<output_channel> output = std::make_unique<output_channel>();
+    std::future<uint64_t>           records;
+  };
+  std::deque<job> pending;
+  uint64_t        total = 0;
+  size_t          next  = 0;
+  std::string     chunk;
+  while (next < pieces.size() or not pending.empty()) {
+    while (next < pieces.size() and pending.size() < jobs) {
+      job& j    = pending.emplace_back();
+      j.records = std::async(std::launch::async, grep_piece, pieces[next++], std::cref(opts), std::ref(*j.output));
+    }
+    while (pending.front().output->pop(chunk)) std::fwrite(chunk.data(), 1, chunk.size(), stdout);
+    total += pending.front().records.get();
+    pending.pop_front();
+  }
+  if (opts.count) std::printf("%llu\n", static_cast<unsigned long long>(total));
+  return total > 0 ? 0 : 1;
+}
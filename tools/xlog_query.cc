@@ -0,0 +1,122 @@
+//
+// xlog / xlog_query.cc
+// Created by brian on 2024-08-11.
+//
+// 按时间范围从日志文件中取出记录, 借助 setLogIndex 写出的 .idx 时间索引只读取相关的字节范围.
+// 用法: xlog_query --from <时间> --to <时间> [--utc] [-v] file ...
+//   时间可以写成日志中的形式 "2024-08-09 10:00:00[.123]"(本地时间, 加 --utc 时为 UTC),
+//   ISO 8601 的 "2024-08-09T02:00:00.000Z", HTTP 日期 "Fri, 09 Aug 2024 02:00:00 GMT", 或 unix 秒数;
+//   省略 --from / --to 表示不限. 没有索引的文件整体扫描, 索引末尾尚未记录的部分也会扫描.
+//   支持默认行格式和 setLogJson 的 JSON 行; 二进制日志请先用 xlog_decode 还原
+
+#include "tool_util.hh"
+
+#include "xlog/detail/binlog.hh"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+using namespace xlog::tools;
+
+struct query_stats {
+  uint64_t total   = 0;
+  uint64_t scanned = 0;
+  uint64_t lines   = 0;
+};
+
+/// @brief 输出 text 中时间在 [from, to] 内的行; 不以时间开头的行(多行日志的后续行)跟随上一行
+void scan(std::string_view text, int64_t from, int64_t to, line_clock& clock, query_stats& stats) {
+  bool        keep = false;
+  const char* run  = nullptr; // 连续命中的行一起写出
+  size_t      pos  = 0;
+  while (pos < text.size()) {
+    size_t const nl  = text.find('\n', pos);
+    size_t const end = nl == std::string_view::npos ? text.size() : nl + 1;
+    std::string_view line = text.substr(pos, end - pos);
+    if (pos == 0 and line.starts_with("\xEF\xBB\xBF")) line.remove_prefix(3);
+    int64_t t;
+    if (clock.parse(line, t)) keep = t >= from and t <= to;
+    if (keep) {
+      if (run == nullptr) run = line.data();
+      ++stats.lines;
+    } else if (run) {
+      std::fwrite(run, 1, line.data() - run, stdout);
+      run = nullptr;
+    }
+    pos = end;
+  }
+  if (run) std::fwrite(run, 1, text.data() + text.size() - run, stdout);
+}
+
+void query_file(const std::string& path, int64_t from, int64_t to, bool utc, query_stats& stats) {
+  uint64_t                                   size;
+  std::vector<std::pair<uint64_t, uint64_t>> ranges;
+  if (not file_ranges(path, from, to, size, ranges)) {
+    std::fprintf(stderr, "xlog_query: cannot open %s\n", path.c_str());
+    return;
+  }
+  stats.total += size;
+
+  line_clock clock(utc);
+  for (auto [begin, end] : ranges) {
+    if (begin >= end) continue;
+    mapped_range const range(path, begin, end);
+    if (begin == 0 and range.view().starts_with(binlog_magic)) {
+      std::fprintf(stderr, "xlog_query: %s is a binary log, decode it with xlog_decode first\n", path.c_str());
+      return;
+    }
+    stats.scanned += range.view().size();
+    scan(range.view(), from, to, clock, stats);
+  }
+}
+} // namespace
+
+int main(int argc, char** argv) {
+  int64_t                  from = INT64_MIN, to = INT64_MAX;
+  bool                     utc     = false;
+  bool                     verbose = false;
+  std::vector<std::string> files;
+  std::string_view         fromArg, toArg;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view const arg = argv[i];
+    if ((arg == "--from" or arg == "--to") and i + 1 < argc) {
+      (arg == "--from" ? fromArg : toArg) = argv[++i];
+    } else if (arg == "--utc") {
+      utc = true;
+    } else if (arg == "-v") {
+      verbose = true;
+    } else if (arg == "-h" or arg == "--help") {
+      std::printf("usage: %s [--from TIME] [--to TIME] [--utc] [-v] file ...\n"
+                  "print log lines whose time is within [from, to], using .idx sidecar files when present\n",
+                  argv[0]);
+      return 0;
+    } else if (not skipped(arg)) {
+      files.emplace_back(arg);
+    }
+  }
+  if ((not fromArg.empty() and not parse_bound(fromArg, utc, from)) or
+      (not toArg.empty() and not parse_bound(toArg, utc, to))) {
+    std::fprintf(stderr, "xlog_query: cannot parse time bound\n");
+    return 2;
+  }
+  if (files.empty()) {
+    std::fprintf(stderr, "xlog_query: no log files given\n");
+    return 2;
+  }
+
+  auto const  start = std::chrono::steady_clock::now();
+  query_stats stats;
+  for (auto const& file : files) query_file(file, from, to, utc, stats);
+  std::fflush(stdout);
+  if (verbose) {
+    auto const ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::fprintf(stderr, "xlog_query: %llu lines, scanned %llu of %llu bytes in %.2f ms\n",
+                 static_cast<unsigned long long>(stats.lines), static_cast<unsigned long long>(stats.scanned),
+                 static_cast<unsigned long long>(stats.total), ms);
+  }
+  return 0;
+}